@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2017 Université Clermont Auvergne, CNRS/IN2P3, LPC
+ * Author: Valentin NIESS (niess@in2p3.fr)
+ *
+ * This software is a C99 library for the simulation of the coupled transport
+ * of ultra high energy taus and neutrinos through the Earth, by Monte-Carlo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/* Microbenchmarks of some hot spots of DANTON. The library source is
+ * included in order to access its internal functions. Results are printed
+ * to stdout, one JSON object per line.
+ */
+#include "danton.c"
+
+/* Primary models and recorders. */
+#include "danton/primary/brokenlaw.h"
+#include "danton/primary/discrete.h"
+#include "danton/primary/powerlaw.h"
+#include "danton/primary/tabulated.h"
+#include "danton/recorder/text.h"
+
+/* Default number of calls per benchmark. */
+#define BENCH_CALLS 10000000L
+
+/* Sink for the benchmarked results, preventing their optimisation. */
+static volatile double sink = 0.;
+
+/* Get the current time, in s. */
+static double bench_now(void)
+{
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return t.tv_sec + 1E-09 * t.tv_nsec;
+}
+
+/* Report the result of a benchmark. */
+static void bench_report(const char * name, long calls, double t)
+{
+        printf("{\"benchmark\": \"%s\", \"calls\": %ld, \"ns_per_call\": "
+               "%.3lf}\n",
+            name, calls, 1E+09 * t / calls);
+        fflush(stdout);
+}
+
+/* Benchmark the default random engine. */
+static void bench_random(struct simulation_context * context, long calls)
+{
+        context->random.stream = 0;
+        context->random.index = 0;
+        double s = 0.;
+        const double t0 = bench_now();
+        long i;
+        for (i = 0; i < calls; i++) s += random_uniform01(context);
+        bench_report("random_uniform01", calls, bench_now() - t0);
+        sink += s;
+}
+
+/* Benchmark the medium callback, for random positions and directions
+ * within 20 km of the Earth surface.
+ */
+static void bench_medium(struct simulation_context * context, long calls)
+{
+#define BENCH_POINTS 1024
+        static double position[BENCH_POINTS][3], direction[BENCH_POINTS][3];
+        int i;
+        for (i = 0; i < BENCH_POINTS; i++) {
+                const double r = PREM_EARTH_RADIUS +
+                    2E+04 * (random_uniform01(context) - 0.5);
+                const double ct = 2. * random_uniform01(context) - 1.;
+                const double st = sqrt(1. - ct * ct);
+                const double phi = 2. * M_PI * random_uniform01(context);
+                position[i][0] = r * st * cos(phi);
+                position[i][1] = r * st * sin(phi);
+                position[i][2] = r * ct;
+                const double cu = 2. * random_uniform01(context) - 1.;
+                const double su = sqrt(1. - cu * cu);
+                const double psi = 2. * M_PI * random_uniform01(context);
+                direction[i][0] = su * cos(psi);
+                direction[i][1] = su * sin(psi);
+                direction[i][2] = cu;
+        }
+
+        struct generic_state state;
+        memset(&state, 0x0, sizeof(state));
+        state.context = context;
+        double s = 0.;
+        const double t0 = bench_now();
+        long j;
+        for (j = 0; j < calls; j++) {
+                const int k = j % BENCH_POINTS;
+                s += medium(position[k], direction[k], &state);
+        }
+        bench_report("medium", calls, bench_now() - t0);
+        sink += s;
+#undef BENCH_POINTS
+}
+
+/* Benchmark the flux callback of a primary model, for log-uniform
+ * energies. The benchmark is skipped if the primary could not be created.
+ */
+static void bench_flux(struct simulation_context * context, const char * name,
+    struct danton_primary * primary, long calls)
+{
+        if (primary == NULL) {
+                fprintf(stderr, "%s\n", danton_error_pop(NULL));
+                return;
+        }
+
+#define BENCH_ENERGIES 1024
+        static double energy[BENCH_ENERGIES];
+        const double lnE0 = log(primary->energy[0]);
+        const double dlnE = log(primary->energy[1]) - lnE0;
+        int i;
+        for (i = 0; i < BENCH_ENERGIES; i++)
+                energy[i] = exp(lnE0 + dlnE * random_uniform01(context));
+
+        double s = 0.;
+        const double t0 = bench_now();
+        long j;
+        for (j = 0; j < calls; j++)
+                s += primary->flux(primary, energy[j % BENCH_ENERGIES]);
+        bench_report(name, calls, bench_now() - t0);
+        sink += s;
+        danton_destroy((void **)&primary);
+#undef BENCH_ENERGIES
+}
+
+/* Benchmark the text recorder, writing to the null device. */
+static void bench_text(struct simulation_context * context, long calls)
+{
+        struct danton_text * text = danton_text_create("/dev/null");
+        if (text == NULL) return;
+
+        struct danton_state primary = { 16, 1E+09, { 0., 0., 6.3E+06 },
+                { 0., 0., 1. } };
+        struct danton_state vertex = { 15, 3E+08, { 0., 0., 6.37E+06 },
+                { 0., 0., 1. } };
+        struct danton_state final = { 15, 1E+08, { 0., 0., 6.372E+06 },
+                { 0., 0., 1. } };
+        struct danton_product product[3] = { { 16, { 1E+07, 0., 2E+07 } },
+                { -211, { 2E+07, 1E+06, 3E+07 } },
+                { 111, { 3E+07, -1E+06, 1E+07 } } };
+        struct danton_event event = { 0, 1.5E-03, &primary, 1, &vertex, &final,
+                3, product };
+
+        const double t0 = bench_now();
+        long i;
+        for (i = 0; i < calls; i++) {
+                event.id = i;
+                text->base.record_event(&context->api, &text->base, &event);
+        }
+        danton_text_destroy(&text);
+        bench_report("text_recorder", calls, bench_now() - t0);
+}
+
+int main(int argc, char * argv[])
+{
+        long calls = (argc > 1) ? strtol(argv[1], NULL, 10) : BENCH_CALLS;
+        if (calls <= 0) calls = BENCH_CALLS;
+
+        /* Initialise DANTON with a PREM Earth. */
+        if ((danton_initialise(NULL, NULL, NULL, NULL, NULL) !=
+                EXIT_SUCCESS) ||
+            (danton_earth_model("PREM", NULL, 0, NULL, 0., NULL) !=
+                EXIT_SUCCESS)) {
+                fprintf(stderr, "%s\n", danton_error_pop(NULL));
+                return EXIT_FAILURE;
+        }
+        struct danton_context * context = danton_context_create();
+        if (context == NULL) {
+                fprintf(stderr, "%s\n", danton_error_pop(NULL));
+                return EXIT_FAILURE;
+        }
+        const unsigned long seed = 1;
+        danton_context_seed(context, &seed);
+        struct simulation_context * context_ =
+            (struct simulation_context *)context;
+
+        /* Run the benchmarks. */
+        bench_random(context_, calls);
+        bench_medium(context_, calls);
+
+        bench_flux(context_, "flux_discrete",
+            (struct danton_primary *)danton_discrete_create(1E+09, 1.),
+            calls);
+        bench_flux(context_, "flux_powerlaw",
+            (struct danton_primary *)danton_powerlaw_create(
+                1E+06, 1E+12, -2., 1.),
+            calls);
+        const double energy[4] = { 1E+06, 1E+08, 1E+10, 1E+12 };
+        const double exponent[3] = { -2., -2.5, -3. };
+        bench_flux(context_, "flux_brokenlaw",
+            (struct danton_primary *)danton_brokenlaw_create(
+                3, energy, exponent, 1.),
+            calls);
+#define BENCH_NODES 61
+        double e[BENCH_NODES], f[BENCH_NODES];
+        int i;
+        for (i = 0; i < BENCH_NODES; i++) {
+                e[i] = 1E+06 * pow(10., 0.1 * i);
+                f[i] = pow(e[i], -2.) * (1. + 0.1 * sin(i));
+        }
+        bench_flux(context_, "flux_tabulated",
+            (struct danton_primary *)danton_tabulated_create(
+                BENCH_NODES, e, f),
+            calls);
+#undef BENCH_NODES
+
+        bench_text(context_, calls / 10);
+
+        danton_context_destroy(&context);
+        danton_finalise();
+        return EXIT_SUCCESS;
+}
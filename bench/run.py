@@ -0,0 +1,83 @@
+# -*- coding: utf-8 -*-
+#
+# Copyright (C) 2017 Université Clermont Auvergne, CNRS/IN2P3, LPC
+# Author: Valentin NIESS (niess@in2p3.fr)
+#
+# This software is a C99 executable dedicated to the sampling of decaying
+# taus from ultra high energy neutrinos.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+
+"""Run the reference workloads and report their performances.
+
+Each card of `bench/cards` is run with `bin/danton --stats`. A JSON object is
+printed per card, on a single line, with the run rate in events per second,
+the time per transport step in ns, i.e. per call to the medium callback, and
+the peak resident memory in kB.
+"""
+
+import glob
+import json
+import os
+import subprocess
+import sys
+
+def run(card, executable="bin/danton"):
+    """Run a reference card and return its performances."""
+    name = os.path.splitext(os.path.basename(card))[0]
+    with open(card) as f:
+        settings = json.load(f)
+    with open(os.devnull, "w") as devnull:
+        p = subprocess.Popen((executable, "--stats", card), stdout=devnull,
+                             stderr=subprocess.PIPE)
+        _, err = p.communicate()
+    err = err.decode("utf-8")
+    if p.returncode != 0:
+        return {"card": name, "error": err.strip()}
+    stats = json.loads(err[err.rfind('{\n    "events"'):])
+
+    # Grammage scan points are not Monte-Carlo events. Thus, let us count
+    # them from the card. Otherwise, an empty run is flagged as an error
+    # since it would not benchmark the recording of events.
+    events = stats["events"]
+    if events == 0:
+        events = settings["events"]
+    elif stats["published"] == 0:
+        return {"card": name, "error": "no event published"}
+    steps = stats["stages"]["medium"]["calls"]
+    wall = stats["wall"]
+    return {
+        "card": name,
+        "events": events,
+        "published": stats["published"],
+        "wall": wall,
+        "cpu": stats["cpu"],
+        "events_per_s": events / wall if wall > 0 else None,
+        "steps": steps,
+        "ns_per_step": 1E+09 * wall / steps if steps > 0 else None,
+        "rss": stats["rss"]}
+
+if __name__ == "__main__":
+    cards = sys.argv[1:]
+    if not cards:
+        cards = sorted(glob.glob(os.path.join(os.path.dirname(__file__),
+                                              "cards", "*.json")))
+    rc = 0
+    for card in cards:
+        result = run(card)
+        if "error" in result:
+            rc = 1
+        print(json.dumps(result, sort_keys=True))
+        sys.stdout.flush()
+    sys.exit(rc)
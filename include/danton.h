@@ -66,6 +66,20 @@ struct danton_primary;
 typedef double danton_primary_cb(
     struct danton_primary * primary, double energy);
 
+/**
+ * Callback for sampling the energy of a primary neutrino.
+ *
+ * @param  primary  Handle for the primary data.
+ * @param  u        A uniform random number in [0, 1].
+ * @param  pdf      The pdf of the sampled energy, in GeV^-1.
+ * @return          The sampled energy, in GeV.
+ *
+ * The pdf must be normalised to one over the energy range of the model. For a
+ * model with a single energy, the pdf is not used.
+ */
+typedef double danton_primary_sample_cb(
+    struct danton_primary * primary, double u, double * pdf);
+
 /**
  * Base data for a primary flux model.
  *
@@ -77,6 +91,11 @@ struct danton_primary {
         danton_primary_cb * flux;
         /** The energy range over which the model is defined, in GeV. */
         double energy[2];
+        /**
+         * The energy sampling callback, or `ǸULL`. If not provided, primary
+         * energies are sampled log-uniformly and weighted by the flux.
+         */
+        danton_primary_sample_cb * sample;
 };
 
 /**
@@ -102,6 +121,12 @@ struct danton_sampler {
         /**
          * A weight vector specifying the sampling probabilities, in [0,1],
          * for all particles.
+         *
+         * The weights are relative, i.e. they are normalised to their sum.
+         * In backward mode only tau weights are used. The Monte-Carlo
+         * weight of a backward event is divided by the probability of its
+         * final tau. Thus, the events estimate the flux summed over all
+         * sampled species, not the flux of each species.
          */
         double weight[DANTON_PARTICLE_N];
 };
@@ -214,6 +239,14 @@ enum danton_run_event {
 typedef int danton_run_cb(struct danton_context * context,
     enum danton_run_event event, int medium, struct danton_state * state);
 
+/**
+ * Callback for a custom random engine.
+ *
+ * @param  context Handle for the simulation context.
+ * @return         A pseudo random number in ]0,1[, uniformly.
+ */
+typedef double danton_random_cb(struct danton_context * context);
+
 /** The available run modes. */
 enum danton_mode {
         /** Backward Monte-Carlo simulation. */
@@ -226,6 +259,112 @@ enum danton_mode {
         DANTON_MODE_N
 };
 
+/** The sequences for generating backward Monte-Carlo events. */
+enum danton_sequence {
+        /** Pseudo random numbers. */
+        DANTON_SEQUENCE_RANDOM = 0,
+        /** A Sobol sequence, scrambled with a random digital shift. */
+        DANTON_SEQUENCE_SOBOL,
+        /** A Latin hypercube over the events of a run. */
+        DANTON_SEQUENCE_LATIN_HYPERCUBE,
+        /** The total number of sequences. */
+        DANTON_SEQUENCE_N
+};
+
+/** The instrumented stages of a simulation. */
+enum danton_stage {
+        /** Neutrino transport with ENT, including the medium lookups. */
+        DANTON_STAGE_ENT = 0,
+        /** Tau transport with PUMAS, including the medium lookups. */
+        DANTON_STAGE_PUMAS,
+        /** Medium lookup, including the topography lookups. */
+        DANTON_STAGE_MEDIUM,
+        /** Topography elevation lookup. */
+        DANTON_STAGE_TOPOGRAPHY,
+        /** Tau decays. */
+        DANTON_STAGE_DECAY,
+        /** Recording of events. */
+        DANTON_STAGE_RECORDER,
+        /** The total number of stages. */
+        DANTON_STAGE_N
+};
+
+/**
+ * Running totals of Monte-Carlo runs shared among contexts.
+ *
+ * The totals are not reset by `danton_run`. Thus, they must be zeroed
+ * before a multithreaded run.
+ */
+struct danton_tally {
+        /** The number of generated Monte-Carlo events. */
+        long events;
+        /** The number of published events. */
+        long published;
+        /** The sum of the weights of the published events. */
+        double weight_sum;
+        /** The sum of the squared weights of the published events. */
+        double weight_sum2;
+};
+
+/**
+ * Run statistics of a simulation context.
+ *
+ * The counters are cumulated over all runs of a context, excluding the
+ * trials of `danton_biasing_tune`. Note that the per stage timings are only
+ * available if the library was built with the `DANTON_STATS` flag. Otherwise
+ * they are left to zero. The timings are inclusive, i.e. the time of the
+ * medium stage is also accounted for in the ENT and PUMAS stages, and the
+ * time of the topography stage in the medium stage.
+ */
+struct danton_stats {
+        /** The number of generated Monte-Carlo events. */
+        long events;
+        /** The number of published events. */
+        long published;
+        /** The sum of the weights of the published events. */
+        double weight_sum;
+        /** The sum of the squared weights of the published events. */
+        double weight_sum2;
+        /** The number of calls per stage. */
+        long calls[DANTON_STAGE_N];
+        /** The cumulated wall clock time per stage, in s. */
+        double wall[DANTON_STAGE_N];
+        /** The cumulated CPU time per stage, in s. */
+        double cpu[DANTON_STAGE_N];
+};
+
+/**
+ * Biasing parameters of backward Monte-Carlo runs.
+ *
+ * These parameters do not change the expectation of the results, only the
+ * spread of the events weights. See `danton_biasing_tune` for an automatic
+ * setting of these parameters.
+ */
+struct danton_biasing {
+        /**
+         * The bias factor for backward tau decays, provided to ALOUETTE.
+         *
+         * Starts initialised to `6`. It must be strictly positive.
+         */
+        double decay;
+        /**
+         * The grammage scale of the backward tau transport, in kg/m^2.
+         *
+         * Starts initialised to `3E+07`. The backward tau grammage is drawn
+         * from an exponential law with this scale. It should match the
+         * typical grammage travelled by the taus.
+         */
+        double grammage;
+        /**
+         * The probability to accept a tau production vertex in the ground.
+         *
+         * Starts initialised to `0.1`. Otherwise, the tau is backward
+         * transported further, in order to recycle the event. It must be in
+         * ]0, 1[.
+         */
+        double recycle;
+};
+
 /** Handle for a simulation context.
  *
  * This structure is a proxy to thread specific simulation data. It exposes
@@ -251,6 +390,21 @@ struct danton_context {
          * By default the taus are decayed.
          */
         int decay;
+        /** The biasing parameters of backward Monte-Carlo runs. */
+        struct danton_biasing biasing;
+        /**
+         * The sequence for generating backward Monte-Carlo events.
+         *
+         * Starts initialised to `DANTON_SEQUENCE_RANDOM`. Otherwise, the
+         * elevation, azimuth, energy and altitude of the sampled particles
+         * are drawn from the given sequence over the sampler ranges. The
+         * transport still uses pseudo random numbers. The scrambling of a
+         * Sobol sequence is set by the seed, and its points are indexed by
+         * the event index, thus contexts running disjoint ranges of events
+         * share the same sequence. A Latin hypercube is stratified over the
+         * events of a run of a context, and it is at most of size 2^32.
+         */
+        enum danton_sequence sequence;
         /**
          * Array of pointers to the primary flux models for each neutrino
          * flavour.
@@ -281,6 +435,70 @@ struct danton_context {
          * run action(s) is optionnal.
          */
         danton_run_cb * run_action;
+        /**
+         * Counter of published events shared among contexts.
+         *
+         * Starts initialised to `ǸULL`, i.e. each context counts its own
+         * published events. For a multithreaded run, point the contexts to a
+         * same counter, initialised to zero, in order to stop all of them
+         * once the *requested* number of events of `danton_run` has been
+         * published in total. The counter is updated atomically.
+         */
+        long * published;
+        /**
+         * Index of the first Monte-Carlo event of a run.
+         *
+         * Starts initialised to `0`. The events of a run are numbered from
+         * this index. With the default random engine, the index of an event
+         * also selects its random stream. Thus, any single event can be
+         * replayed in isolation by running it alone with the same seed and
+         * the same index, provided that ALOUETTE/TAUOLA is not used, since
+         * it has its own global random engine. This is the case for forward
+         * runs using a decay library, see `danton_decay_library`. Backward
+         * runs always use ALOUETTE/TAUOLA. In addition, the run must not stop
+         * early, e.g. on a *requested* number of events, a *precision* or a
+         * *time_limit*, and a Latin hypercube *sequence* must not be used.
+         */
+        long event_offset;
+        /**
+         * Callback for a custom random engine.
+         *
+         * Starts initialised to `ǸULL`, i.e. the default counter-based
+         * Philox4x32-10 engine is used, see `danton_context_seed`.
+         */
+        danton_random_cb * random;
+        /**
+         * Target relative precision of the run estimate.
+         *
+         * Starts initialised to `0`, i.e. disabled. If strictly positive, a
+         * Monte-Carlo run stops as soon as the relative standard error on the
+         * mean weight of its events falls below this value. The error is
+         * estimated from the sum of the weights and of their squares. At
+         * least 100 events must have been published before stopping. If the
+         * *tally* is set, the criterion applies to the totals over all
+         * contexts sharing it. Otherwise, it applies to each context
+         * separately.
+         */
+        double precision;
+        /**
+         * Wall time budget of a run, in s.
+         *
+         * Starts initialised to `0`, i.e. disabled. If strictly positive, a
+         * Monte-Carlo run stops once it has lasted for this time. Events
+         * being processed are completed.
+         */
+        double time_limit;
+        /**
+         * Running totals shared among contexts.
+         *
+         * Starts initialised to `ǸULL`, i.e. each context tests the
+         * *precision* criterion on its own events. For a multithreaded run,
+         * point the contexts to a same tally, initialised to zero, in order
+         * to stop all of them once the requested precision is reached in
+         * total. The tally is updated under the lock provided to
+         * `danton_initialise`.
+         */
+        struct danton_tally * tally;
 };
 
 /**
@@ -290,7 +508,10 @@ struct danton_context {
  *
  * For multithreaded usage the user must supply a pair of lock and unlock
  * callbacks ensuring exclusive access to critical data by the simulation
- * contexts.
+ * contexts. This includes tau decays, since ALOUETTE/TAUOLA has a process
+ * wide state. The lock is held once per decay, the products being buffered
+ * in the context. With a library of pre-sampled decays, see
+ * `danton_decay_library`, forward decays require no lock at all.
  */
 typedef int danton_lock_cb(void);
 
@@ -313,6 +534,45 @@ typedef int danton_lock_cb(void);
 DANTON_API int danton_initialise(const char * pdf, const char * mdf,
     const char * dedx, danton_lock_cb * lock, danton_lock_cb * unlock);
 
+/**
+ * Set the cache directory for the physics tables.
+ *
+ * @param  path    Path to the cache directory, or `NULL`.
+ * @return         `EXIT_SUCCESS` on success, `EXIT_FAILURE` otherwise.
+ *
+ * The PUMAS tables are computed from the MDF and from the energy loss tables
+ * at the first run. They are then cached, keyed by a hash of their inputs. If
+ * no *path* is provided the `DANTON_CACHE` environment variable is used, if
+ * set. Otherwise the cache is located under `$XDG_CACHE_HOME/danton`, or
+ * `$HOME/.cache/danton`. An empty path disables the cache.
+ *
+ * __Warning__ : this function must be called before the first run.
+ */
+DANTON_API int danton_cache_directory(const char * path);
+
+/**
+ * Set the size of the library of pre-sampled tau decays.
+ *
+ * @param  size    The number of decays per tau charge, or `0`.
+ * @return         `EXIT_SUCCESS` on success, `EXIT_FAILURE` otherwise.
+ *
+ * By default tau decays are sampled with ALOUETTE/TAUOLA, which has a global
+ * state. If a positive *size* is provided, a library of decays is instead
+ * generated at initialisation, in the tau rest frame. At run time a decay is
+ * randomly picked from the library, rotated and boosted to the tau momentum,
+ * without any lock. The library is cached, see `danton_cache_directory`.
+ *
+ * Note that the library assumes that the tau polarisation is along its
+ * momentum, as in forward runs. Backward decays are still done with
+ * ALOUETTE/TAUOLA, except for the final tau decay. Note also that the library
+ * is generated with the global random engine of ALOUETTE/TAUOLA. Thus, it
+ * does not depend on the seed of the simulation contexts, and it is only
+ * reproducible through its cache.
+ *
+ * __Warning__ : this function must be called before the first run.
+ */
+DANTON_API int danton_decay_library(long size);
+
 /**
  * Finalise the danton library.
  *
@@ -326,7 +586,10 @@ DANTON_API void danton_finalise(void);
  *
  * @param  any  The address of the object pointer.
  *
- * Note that at return the pointer is set to `NULL`.
+ * Note that at return the pointer is set to `NULL`. Text and binary
+ * recorders are not flat objects, since they keep their output stream open
+ * between records. They must be destroyed with `danton_text_destroy` or
+ * `danton_binary_destroy`, otherwise their stream and its buffer are leaked.
  */
 DANTON_API void danton_destroy(void ** any);
 
@@ -370,6 +633,26 @@ DANTON_API int danton_earth_model(const char * geodesic,
     const char * topography, int stack_size, const char * material,
     double density, int * sea);
 
+/**
+ * Set the grid of the topography data, for caching elevation values.
+ *
+ * @param spacing    The grid spacing of the topography data, in arcsec.
+ * @return           `EXIT_SUCCESS` on success, `EXIT_FAILURE` otherwise.
+ *
+ * __Warning__ : this function is **not** thread safe. It sets the Earth
+ * model globally.
+ *
+ * By default, TURTLE is queried for each ground elevation. If a strictly
+ * positive *spacing* is provided, the elevation values at the corners of the
+ * last visited grid cell are cached instead, and the ground elevation is
+ * bilinearly interpolated from them, as done by TURTLE. The grid nodes are
+ * assumed to lie at integer multiples of *spacing* in latitude and
+ * longitude, e.g. 1 arcsec for ASTER-GDEM2 or SRTMGL1 tiles. Thus, the
+ * *spacing* **must** match the topography data, otherwise the ground
+ * elevation differs. Set a null *spacing* in order to disable the cache.
+ */
+DANTON_API int danton_topography_grid(double spacing);
+
 /**
  * Get the current topography datum.
  * @return  A `turtle_datum` pointer, or `NULL`.
@@ -386,7 +669,7 @@ void * danton_get_datum(void);
 /**
  * Get a random number from DANTON's stream.
  * @param  context A simulation context or `NULL`.
- * @return         A pseudo random number in [0,1], uniformly.
+ * @return         A pseudo random number in ]0,1[, uniformly.
  */
 double danton_get_uniform01(struct danton_context * context);
 
@@ -443,6 +726,46 @@ DANTON_API struct danton_context * danton_context_create(void);
  */
 DANTON_API void danton_context_destroy(struct danton_context ** context);
 
+/**
+ * Seed the random engine of a simulation context.
+ *
+ * @param  context  A handle for the context.
+ * @param  seed     The seed value, or `NULL`.
+ * @return          `EXIT_SUCCESS` on success, `EXIT_FAILURE` otherwise.
+ *
+ * If no *seed* is provided a random one is drawn from `/dev/urandom`, which is
+ * also the initial setting of a new context. The random stream of each
+ * Monte-Carlo event is determined by the seed and by the event index, see the
+ * `event_offset` of the context. Thus, contexts sharing a seed but running
+ * disjoint event ranges draw independent numbers.
+ */
+DANTON_API int danton_context_seed(
+    struct danton_context * context, const unsigned long * seed);
+
+/**
+ * Get the state of the random engine of a simulation context.
+ *
+ * @param  context  A handle for the context.
+ * @param  seed     The seed value, or `NULL`.
+ * @param  stream   The current random stream, i.e. event index, or `NULL`.
+ * @param  index    The number of draws in the current stream, or `NULL`.
+ */
+DANTON_API void danton_context_random_state(struct danton_context * context,
+    unsigned long * seed, long * stream, long * index);
+
+/**
+ * Get the run statistics of a simulation context.
+ *
+ * @param  context  A handle for the context.
+ * @param  stats    The statistics.
+ * @param  reset    Flag to reset the statistics after the copy.
+ *
+ * The statistics are copied to *stats*, if not `NULL`. The per stage timings
+ * require the library to be built with the `DANTON_STATS` flag.
+ */
+DANTON_API void danton_context_stats(struct danton_context * context,
+    struct danton_stats * stats, int reset);
+
 /**
  * Run a Monte-Carlo simulation or a grammage scan.
  *
@@ -453,11 +776,106 @@ DANTON_API void danton_context_destroy(struct danton_context ** context);
  *
  * Depending on the context *mode* a Monte-Carlo simulation or a grammage
  * scan is done. Note that setting *requested* to zero or less ignores this
- * option, resulting in all events to be processed.
+ * option, resulting in all events to be processed. If the context *published*
+ * counter is set, *requested* applies to the total count over all contexts
+ * sharing it. A Monte-Carlo run might also stop earlier, according to the
+ * *precision* and *time_limit* of the context. Note that the *precision*
+ * applies to the totals of the context *tally*, if set.
  */
 DANTON_API int danton_run(
     struct danton_context * context, long events, long requested);
 
+/**
+ * Tune the biasing parameters of backward Monte-Carlo runs.
+ *
+ * @param  context      The simulation context to use.
+ * @param  events       The number of Monte-carlo events per trial.
+ * @return              `EXIT_SUCCESS` on success, `EXIT_FAILURE` otherwise.
+ *
+ * The context must be configured for a backward Monte-Carlo run. Then, trial
+ * runs of *events* each are done for a set of biasing parameters, one
+ * parameter at a time. The parameters that maximise the efficiency, i.e. the
+ * inverse of the relative variance of the weights per unit of CPU time, are
+ * set to the context *biasing*. Note that no event is recorded during the
+ * trials, that the context *run_action* is not called and that the trials
+ * use other random streams than `danton_run`, i.e. negative event indices.
+ */
+DANTON_API int danton_biasing_tune(
+    struct danton_context * context, long events);
+
+/**
+ * Start a Monte-Carlo run, for pulling events by batches.
+ *
+ * @param  context      The simulation context to use.
+ * @param  events       The maximum number of Monte-carlo events.
+ * @param  requested    The number of requested events to log.
+ * @return              `EXIT_SUCCESS` on success, `EXIT_FAILURE` otherwise.
+ *
+ * The run is configured as for `danton_run`. However, events are not
+ * processed at once. Instead, sampled events are retrieved by batches with
+ * `danton_next_events`, without invoking the context *recorder*. Note that
+ * grammage scans cannot be pulled.
+ */
+DANTON_API int danton_run_begin(
+    struct danton_context * context, long events, long requested);
+
+/**
+ * Pull the next batch of sampled events.
+ *
+ * @param  context  The simulation context of the current run.
+ * @param  events   An array of at least *n* events to fill.
+ * @param  n        The maximum number of events to retrieve.
+ * @return          The number of events retrieved, or `-1` on failure.
+ *
+ * Monte-Carlo events are generated until *n* sampled events are available or
+ * until the run completes. A return value of zero indicates that the run is
+ * over. The states and the decay products of the retrieved events are owned
+ * by the context. They remain valid until the next call to
+ * `danton_next_events` or `danton_run_end`. The decay products of successive
+ * events are stored contiguously. Thus, the products of a whole batch can be
+ * read as a single array starting from the first event with products.
+ */
+DANTON_API long danton_next_events(
+    struct danton_context * context, struct danton_event * events, long n);
+
+/**
+ * Terminate a run of pulled events.
+ *
+ * @param  context  The simulation context of the current run.
+ *
+ * Any pending event is discarded.
+ */
+DANTON_API void danton_run_end(struct danton_context * context);
+
+/**
+ * Compute the grammage for a batch of lines of sight.
+ *
+ * @param  context      The simulation context to use.
+ * @param  n            The number of lines of sight.
+ * @param  latitude     The geodetic latitudes of the observation points.
+ * @param  longitude    The geodetic longitudes of the observation points.
+ * @param  altitude     The altitudes of the observation points, or `NULL`.
+ * @param  azimuth      The azimuth angles of the directions.
+ * @param  elevation    The elevation angles of the directions.
+ * @param  grammage     The computed grammage values, in kg/m^2.
+ * @return              `EXIT_SUCCESS` on success, `EXIT_FAILURE` otherwise.
+ *
+ * The input arrays must hold *n* values, in degrees or in m. As for grammage
+ * scans with `danton_run`, the grammage is integrated from the observation
+ * point backwards, i.e. along the line of sight opposite to the given
+ * direction, up to the top of the atmosphere. The current Earth model is used.
+ * Consecutive lines of sight sharing the same observation point reuse its
+ * local frame. Thus, it is more efficient to sort the inputs by site.
+ *
+ * If the altitude is `NULL` the observation points are at sea level. Note
+ * that for a spherical Earth, i.e. the PREM geodesic, the altitude is ignored,
+ * as for `danton_run`.
+ */
+DANTON_API int danton_grammage_batch(struct danton_context * context, long n,
+    const double * latitude, const double * longitude,
+    const double * altitude, const double * azimuth,
+    const double * elevation, double * grammage);
+
 /**
  * Get the current number of unprocessed errors.
  *
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2017 Université Clermont Auvergne, CNRS/IN2P3, LPC
+ * Author: Valentin NIESS (niess@in2p3.fr)
+ *
+ * This software is a C99 executable dedicated to the sampling of decaying
+ * taus from ultra high energy neutrinos.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef danton_brokenlaw_h
+#define danton_brokenlaw_h
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef DANTON_API
+#define DANTON_API
+#endif
+
+#include "danton.h"
+
+/** Opaque structure for a broken powerlaw danton_primary. */
+struct danton_brokenlaw;
+
+/**
+ * Create a broken powerlaw danton_primary.
+ *
+ * @param  n          The number of powerlaw segments.
+ * @param  energy     The `n + 1` energy bounds of the segments, in GeV.
+ * @param  exponent   The `n` exponents of the segments.
+ * @param  weight     The intensity of the broken powerlaw source.
+ * @return            The corresponding danton_primary, or `ǸULL`.
+ *
+ * The energy bounds must be strictly increasing. The spectrum is continuous
+ * at the breaks and its integral over the energy range is given by *weight*.
+ */
+DANTON_API struct danton_brokenlaw * danton_brokenlaw_create(
+    int n, const double * energy, const double * exponent, double weight);
+
+/**
+ * Check if a danton_primary is of *broken powerlaw* type.
+ *
+ * @param primary  The danton_primary.
+ * @return         `1` if the primary is a broken powerlaw, `0` otherwise.
+ */
+DANTON_API int danton_brokenlaw_check(struct danton_primary * primary);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
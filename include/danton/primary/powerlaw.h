@@ -35,7 +35,9 @@ extern "C" {
  * Data structure for a powerlaw danton_primary.
  *
  * This is an implementation of a powerlaw danton_primary. The exposed
- * data can be directly modified.
+ * data can be directly read. The weight can be directly modified as well.
+ * Other parameters must be modified with `danton_powerlaw_set` in order to
+ * update the pre-computed normalisation.
  */
 struct danton_powerlaw {
         /** The base danton_primary object. */
@@ -44,6 +46,10 @@ struct danton_powerlaw {
         double exponent;
         /** The weight of the primary source. */
         double weight;
+        /** The pre-computed normalisation of the pdf. */
+        double normalisation;
+        /** The pre-computed range parameter used for sampling. */
+        double range;
 };
 
 /**
@@ -58,6 +64,19 @@ struct danton_powerlaw {
 DANTON_API struct danton_powerlaw * danton_powerlaw_create(
     double energy_min, double energy_max, double exponent, double weight);
 
+/**
+ * Set the properties of a powerlaw danton_primary.
+ *
+ * @param  powerlaw     The powerlaw danton_primary.
+ * @param  energy_min   The minimum energy of the primary neutrino, in GeV.
+ * @param  energy_max   The maximum energy of the primary neutrino, in GeV.
+ * @param  exponent     The exponent of the powerlaw.
+ * @param  weight       The intensity of the powerlaw source.
+ * @return              `EXIT_SUCCESS` on success, `EXIT_FAILURE` otherwise.
+ */
+DANTON_API int danton_powerlaw_set(struct danton_powerlaw * powerlaw,
+    double energy_min, double energy_max, double exponent, double weight);
+
 /**
  * Check if a danton_primary is of *powerlaw* type.
  *
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2017 Université Clermont Auvergne, CNRS/IN2P3, LPC
+ * Author: Valentin NIESS (niess@in2p3.fr)
+ *
+ * This software is a C99 executable dedicated to the sampling of decaying
+ * taus from ultra high energy neutrinos.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef danton_tabulated_h
+#define danton_tabulated_h
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef DANTON_API
+#define DANTON_API
+#endif
+
+#include "danton.h"
+
+/** Opaque structure for a tabulated danton_primary. */
+struct danton_tabulated;
+
+/**
+ * Create a tabulated danton_primary from arrays.
+ *
+ * @param  n        The number of tabulated values.
+ * @param  energy   The tabulated energies of the primary neutrino, in GeV.
+ * @param  flux     The corresponding differential flux values.
+ * @return          The corresponding tabulated danton_primary, or `ǸULL`.
+ *
+ * The energies must be strictly increasing and the flux values must be
+ * positive. The flux is interpolated in log-log, i.e. as a power law between
+ * successive nodes. A segment with a null end value has a null flux. The
+ * integrated flux, i.e. the weight of the primary, is computed from the table.
+ */
+DANTON_API struct danton_tabulated * danton_tabulated_create(
+    int n, const double * energy, const double * flux);
+
+/**
+ * Load a tabulated danton_primary from a file.
+ *
+ * @param  path     The path to the table file.
+ * @return          The corresponding tabulated danton_primary, or `ǸULL`.
+ *
+ * The file must be in text format, with two columns: the energy, in GeV,
+ * and the differential flux. Empty lines and lines starting with a `#` are
+ * skipped.
+ */
+DANTON_API struct danton_tabulated * danton_tabulated_load(const char * path);
+
+/**
+ * Sample the energy of a tabulated danton_primary.
+ *
+ * @param tabulated  The tabulated danton_primary.
+ * @param u          A uniform random number in [0, 1].
+ * @param pdf        The pdf of the sampled energy, or `ǸULL`.
+ * @return           The sampled energy, in GeV.
+ *
+ * The energy is sampled from the interpolated flux by inversion of the
+ * cumulative distribution, in constant time. The returned pdf is normalised
+ * to one over the energy range of the table.
+ */
+DANTON_API double danton_tabulated_sample(
+    const struct danton_tabulated * tabulated, double u, double * pdf);
+
+/**
+ * Check if a danton_primary is of *tabulated* type.
+ *
+ * @param primary  The danton_primary.
+ * @return         `1` if the primary is a tabulated one, `0` otherwise.
+ */
+DANTON_API int danton_tabulated_check(struct danton_primary * primary);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2017 Université Clermont Auvergne, CNRS/IN2P3, LPC
+ * Author: Valentin NIESS (niess@in2p3.fr)
+ *
+ * This software is a C99 executable dedicated to the sampling of decaying
+ * taus from ultra high energy neutrinos.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef danton_binary_h
+#define danton_binary_h
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef DANTON_API
+#define DANTON_API
+#endif
+
+#include "danton.h"
+
+/** The version of the binary format. */
+#define DANTON_BINARY_VERSION 1
+
+/** Operations mode for a binary danton_recorder. */
+enum danton_binary_mode {
+        /** Append to an existing binary file, or create it. */
+        DANTON_BINARY_MODE_APPEND = 0,
+        /** Create a new binary file, or override it. */
+        DANTON_BINARY_MODE_CREATE,
+        /** The number of operations modes.  */
+        DANTON_BINARY_MODE_N
+};
+
+/** Types of records in a binary file. */
+enum danton_binary_record {
+        /** A Monte-Carlo event. */
+        DANTON_BINARY_RECORD_EVENT = 1,
+        /** A grammage value. */
+        DANTON_BINARY_RECORD_GRAMMAGE
+};
+
+/**
+ * Data structure for a binary danton_recorder.
+ *
+ * This is an implementation of a danton_recorder to a *binary* file. The
+ * exposed data can be directly modified.
+ *
+ * All numbers are written in little-endian order, integers as two's
+ * complement and floating points as IEEE 754 doubles. A file starts with an
+ * 8 bytes magic string, `DANTONBF`, followed by the format version (uint32),
+ * the size of the run header (uint32) and the run header itself:
+ *
+ *     int32    mode, decay and longitudinal flags of the context
+ *     float64  latitude, longitude, altitude[2], azimuth[2], elevation[2]
+ *              and energy[2] of the sampler
+ *     uint32   the number of particle weights, N
+ *     float64  weight[N] of the sampler
+ *
+ * Then follow the records, each one prefixed by its size (uint32, excluding
+ * the prefix itself) and its type (uint8, see `danton_binary_record`). An
+ * event record is:
+ *
+ *     int64    id
+ *     float64  weight
+ *     int32    generation
+ *     uint8    flags, bit 0 (1, 2) set if the primary (vertex, final) state
+ *              is present
+ *     state    primary, vertex and final states, if present
+ *     int32    the number of decay products, M
+ *     product  M decay products
+ *
+ * where a state is an int32 PDG ID followed by the float64 energy,
+ * position[3] and direction[3], and a product is an int32 PDG ID followed by
+ * the float64 momentum[3]. A grammage record is the float64 elevation
+ * followed by the float64 grammage value.
+ */
+struct danton_binary {
+        /** The base danton_recorder. */
+        struct danton_recorder base;
+        /** The operation mode. */
+        enum danton_binary_mode mode;
+        /**
+         * The size of the user-space output buffer, in bytes.
+         *
+         * It is applied when the output file is opened, i.e. at the first
+         * record. Set this to zero in order to use the default buffering of
+         * the C library.
+         */
+        int buffer_size;
+};
+
+/**
+ * Create a binary danton_recorder.
+ *
+ * @param  path  The path to the binary file, or `NULL` for `stdout`.
+ * @return       The corresponding binary danton_recorder, or `ǸULL`.
+ */
+DANTON_API struct danton_binary * danton_binary_create(const char * path);
+
+/**
+ * Flush the output stream of a binary danton_recorder.
+ *
+ * @param  binary  The binary danton_recorder.
+ * @return         `EXIT_SUCCESS` on success, `EXIT_FAILURE` otherwise.
+ */
+DANTON_API int danton_binary_flush(struct danton_binary * binary);
+
+/**
+ * Close the output stream of a binary danton_recorder.
+ *
+ * @param  binary  The binary danton_recorder.
+ * @return         `EXIT_SUCCESS` on success, `EXIT_FAILURE` otherwise.
+ *
+ * The output file is kept open between records. This function flushes and
+ * closes it. It is automatically re-opened, in append mode, at the next
+ * record.
+ */
+DANTON_API int danton_binary_close(struct danton_binary * binary);
+
+/**
+ * Destroy a binary danton_recorder.
+ *
+ * @param  binary  The address of the binary danton_recorder.
+ *
+ * This function must be used instead of `danton_destroy` in order to properly
+ * flush and close the output stream. At return the pointer is set to `NULL`.
+ */
+DANTON_API void danton_binary_destroy(struct danton_binary ** binary);
+
+/**
+ * Check if a danton_recorder is of *binary* type.
+ *
+ * @param recorder  The danton_recorder.
+ * @return          `1` if the recorder is a binary one, `0` otherwise.
+ */
+DANTON_API int danton_binary_check(struct danton_recorder * recorder);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
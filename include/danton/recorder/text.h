@@ -52,6 +52,14 @@ struct danton_text {
         struct danton_recorder base;
         /** The operation mode. */
         enum danton_text_mode mode;
+        /**
+         * The size of the user-space output buffer, in bytes.
+         *
+         * It is applied when the output file is opened, i.e. at the first
+         * record. Set this to zero in order to use the default buffering of
+         * the C library.
+         */
+        int buffer_size;
 };
 
 /**
@@ -62,6 +70,36 @@ struct danton_text {
  */
 DANTON_API struct danton_text * danton_text_create(const char * path);
 
+/**
+ * Flush the output stream of a text danton_recorder.
+ *
+ * @param  text  The text danton_recorder.
+ * @return       `EXIT_SUCCESS` on success, `EXIT_FAILURE` otherwise.
+ */
+DANTON_API int danton_text_flush(struct danton_text * text);
+
+/**
+ * Close the output stream of a text danton_recorder.
+ *
+ * @param  text  The text danton_recorder.
+ * @return       `EXIT_SUCCESS` on success, `EXIT_FAILURE` otherwise.
+ *
+ * The output file is kept open between records. This function flushes and
+ * closes it. It is automatically re-opened, in append mode, at the next
+ * record.
+ */
+DANTON_API int danton_text_close(struct danton_text * text);
+
+/**
+ * Destroy a text danton_recorder.
+ *
+ * @param  text  The address of the text danton_recorder.
+ *
+ * This function must be used instead of `danton_destroy` in order to properly
+ * flush and close the output stream. At return the pointer is set to `NULL`.
+ */
+DANTON_API void danton_text_destroy(struct danton_text ** text);
+
 /**
 * Check if a danton_recorder is of *text* type.
 *
@@ -21,6 +21,7 @@
 
 import cStringIO
 import collections
+import struct
 
 # The Earth radius in the Preliminary Earth Model (PEM).
 EARTH_RADIUS = 6371.E+03
@@ -154,3 +155,74 @@ class iter_flux:
             self.field = self.fid.readline().split()
 
         return self.field, self.Event(eventid, primary, final, weight)
+
+class iter_binary:
+    """Iterator over the records of a binary dump.
+    """
+
+    # Data structures for records.
+    State = collections.namedtuple("State", ("pid", "energy", "position",
+        "direction"))
+    Product = collections.namedtuple("Product", ("pid", "momentum"))
+    Event = collections.namedtuple("Event", ("id", "weight", "generation",
+        "primary", "vertex", "final", "product"))
+    Grammage = collections.namedtuple("Grammage", ("elevation", "value"))
+    Run = collections.namedtuple("Run", ("mode", "decay", "longitudinal",
+        "latitude", "longitude", "altitude", "azimuth", "elevation", "energy",
+        "weight"))
+
+    def __init__(self, filename):
+        self.fid = open(filename, "rb")
+        magic, version, size = struct.unpack("<8sII", self.fid.read(16))
+        if magic != "DANTONBF":
+            raise ValueError("invalid binary file")
+        if version != 1:
+            raise ValueError("unsupported format version ({:})".format(
+                version))
+        data = self.fid.read(size)
+        v = struct.unpack_from("<3i10dI", data)
+        weight = struct.unpack_from("<{:}d".format(v[-1]), data, 96)
+        self.run = self.Run(v[0], bool(v[1]), bool(v[2]), v[3], v[4],
+            v[5:7], v[7:9], v[9:11], v[11:13], weight)
+
+    def __delete__(self):
+        if self.fid is not None:
+            self.fid.close()
+            self.fid = None
+
+    def __iter__(self):
+        return self
+
+    def next(self):
+        header = self.fid.read(4) if self.fid else ""
+        if len(header) < 4:
+            if self.fid:
+                self.fid.close()
+                self.fid = None
+            raise StopIteration()
+        size, = struct.unpack("<I", header)
+        data = self.fid.read(size)
+        if ord(data[0]) == 2:
+            return self.Grammage(*struct.unpack_from("<2d", data, 1))
+
+        # Unpack an event record.
+        eventid, weight, generation, flags = struct.unpack_from("<qdiB",
+            data, 1)
+        offset = 22
+        states = []
+        for i in xrange(3):
+            if flags & (1 << i):
+                v = struct.unpack_from("<i7d", data, offset)
+                states.append(self.State(v[0], v[1], v[2:5], v[5:8]))
+                offset += 60
+            else:
+                states.append(None)
+        n, = struct.unpack_from("<i", data, offset)
+        offset += 4
+        product = []
+        for _ in xrange(n):
+            v = struct.unpack_from("<i3d", data, offset)
+            product.append(self.Product(v[0], v[1:4]))
+            offset += 28
+        return self.Event(eventid, weight, generation, states[0], states[1],
+            states[2], product)
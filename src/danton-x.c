@@ -19,18 +19,30 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 
+/* For clock_gettime. */
+#define _POSIX_C_SOURCE 200809L
+
 /* Standard library includes. */
 #include <errno.h>
 #include <float.h>
 #include <math.h>
+#include <pthread.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+/* POSIX includes. */
+#include <sys/resource.h>
 
 /* The DANTON API. */
 #include "danton.h"
+#include "danton/primary/brokenlaw.h"
 #include "danton/primary/discrete.h"
 #include "danton/primary/powerlaw.h"
+#include "danton/primary/tabulated.h"
+#include "danton/recorder/binary.h"
 #include "danton/recorder/text.h"
 
 /* Jasmine with some tea, for parsing the data card in JSON format. */
@@ -55,15 +67,85 @@ static struct {
         int verbosity;
 } stepping_options = { NULL, 0, 0 };
 
+/* The number of worker threads. */
+static int n_threads = 1;
+
+/* The number of events per trial when tuning the biasing, or zero. */
+static int biasing_tune = 0;
+
+/* Data for a worker thread, running its own simulation context. */
+struct worker {
+        pthread_t thread;
+        struct danton_context * context;
+        struct danton_recorder recorder;
+        struct danton_recorder * target;
+        long events;
+        long requested;
+        int rc;
+};
+
+/* The worker threads. */
+static struct worker * workers = NULL;
+
+/* Flag for dumping the run statistics, and the statistics over all
+ * contexts.
+ */
+static int stats_option = 0;
+static struct danton_stats stats;
+
+/* Mutexes for DANTON's critical sections and for the shared recorder. */
+static pthread_mutex_t danton_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t recorder_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Locking and unlocking callbacks for DANTON. */
+static int danton_lock(void)
+{
+        return (pthread_mutex_lock(&danton_mutex) == 0) ? EXIT_SUCCESS :
+                                                          EXIT_FAILURE;
+}
+
+static int danton_unlock(void)
+{
+        return (pthread_mutex_unlock(&danton_mutex) == 0) ? EXIT_SUCCESS :
+                                                            EXIT_FAILURE;
+}
+
+/* Release the worker threads data. */
+static void workers_destroy(void)
+{
+        if (workers == NULL) return;
+        int i;
+        for (i = 0; i < n_threads; i++) {
+                struct danton_context * c = workers[i].context;
+                if (c == NULL) continue;
+                danton_destroy((void **)&c->sampler);
+                danton_context_destroy(&workers[i].context);
+        }
+        free(workers);
+        workers = NULL;
+}
+
+/* Release the event recorder, flushing any pending output. */
+static void recorder_destroy(struct danton_recorder ** recorder)
+{
+        if ((*recorder != NULL) && danton_text_check(*recorder))
+                danton_text_destroy((struct danton_text **)recorder);
+        else if ((*recorder != NULL) && danton_binary_check(*recorder))
+                danton_binary_destroy((struct danton_binary **)recorder);
+        else
+                danton_destroy((void **)recorder);
+}
+
 /* Finalise and exit to the OS. */
 static int gracefully_exit(int rc)
 {
         /* Finalise and exit to the OS. */
         jsmn_tea_destroy(&tea);
+        workers_destroy();
         int i;
         for (i = 0; i < DANTON_PARTICLE_N_NU; i++)
                 danton_destroy((void **)&context->primary[i]);
-        danton_destroy((void **)&context->recorder);
+        recorder_destroy(&context->recorder);
         danton_destroy((void **)&context->sampler);
         danton_context_destroy(&context);
         danton_finalise();
@@ -91,10 +173,14 @@ static void exit_with_help(int code)
 {
         // clang-format off
         fprintf(stderr,
-"Usage: danton [DATACARD.JSON]\n"
+"Usage: danton [-j THREADS] [--stats] [DATACARD.JSON]\n"
 "Simulate the coupled transport of ultra high energy taus and neutrinos\n"
 "through the Earth, by Monte-Carlo.\n"
 "\n"
+"Options:\n"
+" -j THREADS  the number of worker threads, overriding the data card.\n"
+" --stats     dump the run statistics to stderr, in JSON format.\n"
+"\n"
 "Data card:\n"
 "Syntax and examples available from https://github.com/niess/danton.\n"
 "\n"
@@ -132,14 +218,25 @@ static void card_get_range(const char * field, double * range)
         }
 }
 
+/* Extension of output files selecting the binary format. */
+static const char * binary_extension = ".bin";
+
 /* Update the event recorder according to the data card. */
 static void card_update_recorder(void)
 {
         char * output_file;
         jsmn_tea_next_string(tea, 0, &output_file);
-        danton_destroy((void **)&context->recorder);
-        context->recorder =
-            (struct danton_recorder *)danton_text_create(output_file);
+        recorder_destroy(&context->recorder);
+
+        /* Select the recorder type from the file extension. */
+        const int n = (output_file == NULL) ? 0 : strlen(output_file);
+        const int m = strlen(binary_extension);
+        if ((n > m) && (strcmp(output_file + n - m, binary_extension) == 0))
+                context->recorder =
+                    (struct danton_recorder *)danton_binary_create(output_file);
+        else
+                context->recorder =
+                    (struct danton_recorder *)danton_text_create(output_file);
         if (context->recorder == NULL) gracefully_exit(EXIT_FAILURE);
 }
 
@@ -160,6 +257,24 @@ static void card_update_mode(void)
         }
 }
 
+/* Update the sampling sequence according to the data card. */
+static void card_update_sequence(void)
+{
+        char * s;
+        jsmn_tea_next_string(tea, 0, &s);
+        if (strcmp(s, "random") == 0)
+                context->sequence = DANTON_SEQUENCE_RANDOM;
+        else if (strcmp(s, "sobol") == 0)
+                context->sequence = DANTON_SEQUENCE_SOBOL;
+        else if (strcmp(s, "latin-hypercube") == 0)
+                context->sequence = DANTON_SEQUENCE_LATIN_HYPERCUBE;
+        else {
+                ROAR_ERRNO_FORMAT(&handler, &card_update_sequence, EINVAL,
+                    "[%s #%d] invalid sequence `%s`", card_path, tea->index,
+                    s);
+        }
+}
+
 /* List of particle names, following DANTON's ordering. */
 static const char * particle_name[DANTON_PARTICLE_N] = { "nu_tau~", "nu_mu~",
         "nu_e~", "nu_e", "nu_mu", "nu_tau", "tau~", "tau" };
@@ -274,6 +389,70 @@ static struct danton_primary * card_update_primary_powerlaw(void)
         return primary;
 }
 
+/* Get the next token in the JSON card as an array of doubles. */
+static int card_get_array(const char * field, int size, double * array)
+{
+        int n;
+        jsmn_tea_next_array(tea, &n);
+        if ((n < 1) || (n > size)) {
+                ROAR_ERRNO_FORMAT(&handler, &card_get_array, EINVAL,
+                    "[%s #%d] invalid array size for field `%s`", card_path,
+                    tea->index, field);
+        }
+        int i;
+        for (i = 0; i < n; i++)
+                jsmn_tea_next_number(tea, JSMN_TEA_TYPE_DOUBLE, array + i);
+        return n;
+}
+
+/* The maximum number of segments for a broken power law. */
+#define BROKENLAW_MAX_SEGMENTS 16
+
+/* Update the primary flux with a broken power law model. */
+static struct danton_primary * card_update_primary_brokenlaw(void)
+{
+        /* Parse the model parameters. */
+        double energy[BROKENLAW_MAX_SEGMENTS + 1] = { 1E+06, 1E+12 };
+        double exponent[BROKENLAW_MAX_SEGMENTS] = { -2. };
+        double weight = 1.;
+        int n_energy = 2, n_exponent = 1;
+        int i;
+        for (jsmn_tea_next_object(tea, &i); i; i--) {
+                char * field;
+                jsmn_tea_next_string(tea, 1, &field);
+                if (strcmp(field, "energy") == 0)
+                        n_energy = card_get_array(
+                            field, BROKENLAW_MAX_SEGMENTS + 1, energy);
+                else if (strcmp(field, "exponent") == 0)
+                        n_exponent = card_get_array(
+                            field, BROKENLAW_MAX_SEGMENTS, exponent);
+                else if (strcmp(field, "weight") == 0)
+                        jsmn_tea_next_number(
+                            tea, JSMN_TEA_TYPE_DOUBLE, &weight);
+                else {
+                        ROAR_ERRNO_FORMAT(&handler, &card_update_sampler,
+                            EINVAL, "[%s #%d] invalid key `%s`", card_path,
+                            tea->index, field);
+                }
+        }
+        if (n_energy != n_exponent + 1) {
+                ROAR_ERRNO_FORMAT(&handler, &card_update_primary_brokenlaw,
+                    EINVAL, "[%s #%d] inconsistent number of energy bounds "
+                            "and exponents",
+                    card_path, tea->index);
+        }
+
+        /* Create the model. */
+        struct danton_primary * primary =
+            (struct danton_primary *)danton_brokenlaw_create(
+                n_exponent, energy, exponent, weight);
+        if (primary == NULL) {
+                ROAR_ERRWP_MESSAGE(&handler, &card_update_primary_brokenlaw,
+                    -1, "danton error", danton_error_pop(NULL));
+        }
+        return primary;
+}
+
 /* Update the primary flux with a discrete model. */
 static struct danton_primary * card_update_primary_discrete(void)
 {
@@ -307,6 +486,39 @@ static struct danton_primary * card_update_primary_discrete(void)
         return primary;
 }
 
+/* Update the primary flux with a tabulated model. */
+static struct danton_primary * card_update_primary_tabulated(void)
+{
+        /* Parse the model parameters. */
+        char * path = NULL;
+        int i;
+        for (jsmn_tea_next_object(tea, &i); i; i--) {
+                char * field;
+                jsmn_tea_next_string(tea, 1, &field);
+                if (strcmp(field, "path") == 0)
+                        jsmn_tea_next_string(tea, 0, &path);
+                else {
+                        ROAR_ERRNO_FORMAT(&handler, &card_update_sampler,
+                            EINVAL, "[%s #%d] invalid key `%s`", card_path,
+                            tea->index, field);
+                }
+        }
+        if (path == NULL) {
+                ROAR_ERRNO_FORMAT(&handler, &card_update_primary_tabulated,
+                    EINVAL, "[%s #%d] missing `path` for tabulated model",
+                    card_path, tea->index);
+        }
+
+        /* Create the model. */
+        struct danton_primary * primary =
+            (struct danton_primary *)danton_tabulated_load(path);
+        if (primary == NULL) {
+                ROAR_ERRWP_MESSAGE(&handler, &card_update_primary_tabulated,
+                    -1, "danton error", danton_error_pop(NULL));
+        }
+        return primary;
+}
+
 /* Update the primary flux according to the data card. */
 static void card_update_primary(void)
 {
@@ -334,9 +546,15 @@ static void card_update_primary(void)
                 if (strcmp(model, "power-law") == 0)
                         context->primary[index] =
                             card_update_primary_powerlaw();
+                else if (strcmp(model, "broken-power-law") == 0)
+                        context->primary[index] =
+                            card_update_primary_brokenlaw();
                 else if (strcmp(model, "discrete") == 0)
                         context->primary[index] =
                             card_update_primary_discrete();
+                else if (strcmp(model, "tabulated") == 0)
+                        context->primary[index] =
+                            card_update_primary_tabulated();
                 else {
                         ROAR_ERRNO_FORMAT(&handler, &card_update_primary,
                             EINVAL,
@@ -355,6 +573,7 @@ static void card_update_earth_model(void)
         char * topography = NULL;
         char * material = NULL;
         double density = 0.;
+        double grid = -1.;
         int stack_size = 0;
         int sea = -1;
 
@@ -377,6 +596,9 @@ static void card_update_earth_model(void)
                         jsmn_tea_next_string(tea, 0, &material);
                 else if (strcmp(field, "sea") == 0)
                         jsmn_tea_next_bool(tea, &sea);
+                else if (strcmp(field, "grid") == 0)
+                        jsmn_tea_next_number(
+                            tea, JSMN_TEA_TYPE_DOUBLE, &grid);
                 else {
                         ROAR_ERRNO_FORMAT(&handler, &card_update_earth_model,
                             EINVAL, "[%s #%d] invalid key `%s`", card_path,
@@ -391,6 +613,38 @@ static void card_update_earth_model(void)
                 ROAR_ERRWP_MESSAGE(&handler, &card_update_earth_model, -1,
                     "danton error", danton_error_pop(NULL));
         }
+        if ((grid >= 0.) && (danton_topography_grid(grid) != EXIT_SUCCESS)) {
+                ROAR_ERRWP_MESSAGE(&handler, &card_update_earth_model, -1,
+                    "danton error", danton_error_pop(NULL));
+        }
+}
+
+/* Update the biasing parameters according to the data card. */
+static void card_update_biasing(void)
+{
+        /* Parse the data card. */
+        int i;
+        for (jsmn_tea_next_object(tea, &i); i; i--) {
+                char * field;
+                jsmn_tea_next_string(tea, 1, &field);
+                if (strcmp(field, "decay") == 0) {
+                        jsmn_tea_next_number(tea, JSMN_TEA_TYPE_DOUBLE,
+                            &context->biasing.decay);
+                } else if (strcmp(field, "grammage") == 0) {
+                        jsmn_tea_next_number(tea, JSMN_TEA_TYPE_DOUBLE,
+                            &context->biasing.grammage);
+                } else if (strcmp(field, "recycle") == 0) {
+                        jsmn_tea_next_number(tea, JSMN_TEA_TYPE_DOUBLE,
+                            &context->biasing.recycle);
+                } else if (strcmp(field, "tune") == 0) {
+                        jsmn_tea_next_number(
+                            tea, JSMN_TEA_TYPE_INT, &biasing_tune);
+                } else {
+                        ROAR_ERRNO_FORMAT(&handler, &card_update_biasing,
+                            EINVAL, "[%s #%d] invalid key `%s`", card_path,
+                            tea->index, field);
+                }
+        }
 }
 
 /* Update the stepping options according to the data card. */
@@ -423,6 +677,31 @@ static void card_update_stepping(void)
         }
 }
 
+/* Update the seed of the random engine according to the data card. */
+static void card_update_seed(void)
+{
+        int seed;
+        jsmn_tea_next_number(tea, JSMN_TEA_TYPE_INT, &seed);
+        if (seed < 0) {
+                ROAR_ERRNO_FORMAT(&handler, &card_update_seed, EINVAL,
+                    "[%s #%d] invalid seed value `%d`", card_path, tea->index,
+                    seed);
+        }
+        const unsigned long value = seed;
+        danton_context_seed(context, &value);
+}
+
+/* Update the size of the decay library according to the data card. */
+static void card_update_decay_library(void)
+{
+        int size;
+        jsmn_tea_next_number(tea, JSMN_TEA_TYPE_INT, &size);
+        if (danton_decay_library(size) != EXIT_SUCCESS) {
+                ROAR_ERRWP_MESSAGE(&handler, &card_update_decay_library, -1,
+                    "danton error", danton_error_pop(NULL));
+        }
+}
+
 /* Update DANTON's configuration according to the content of the data card. */
 static void card_update(int * n_events, int * n_requested)
 {
@@ -436,12 +715,27 @@ static void card_update(int * n_events, int * n_requested)
                 else if (strcmp(tag, "requested") == 0)
                         jsmn_tea_next_number(
                             tea, JSMN_TEA_TYPE_INT, n_requested);
+                else if (strcmp(tag, "precision") == 0)
+                        jsmn_tea_next_number(
+                            tea, JSMN_TEA_TYPE_DOUBLE, &context->precision);
+                else if (strcmp(tag, "time-limit") == 0)
+                        jsmn_tea_next_number(
+                            tea, JSMN_TEA_TYPE_DOUBLE, &context->time_limit);
+                else if (strcmp(tag, "threads") == 0)
+                        jsmn_tea_next_number(
+                            tea, JSMN_TEA_TYPE_INT, &n_threads);
+                else if (strcmp(tag, "seed") == 0)
+                        card_update_seed();
                 else if (strcmp(tag, "output-file") == 0)
                         card_update_recorder();
                 else if (strcmp(tag, "mode") == 0)
                         card_update_mode();
+                else if (strcmp(tag, "sequence") == 0)
+                        card_update_sequence();
                 else if (strcmp(tag, "decay") == 0)
                         jsmn_tea_next_bool(tea, &context->decay);
+                else if (strcmp(tag, "decay-library") == 0)
+                        card_update_decay_library();
                 else if (strcmp(tag, "longitudinal") == 0)
                         jsmn_tea_next_bool(tea, &context->longitudinal);
                 else if (strcmp(tag, "particle-sampler") == 0)
@@ -452,6 +746,8 @@ static void card_update(int * n_events, int * n_requested)
                         card_update_earth_model();
                 else if (strcmp(tag, "stepping") == 0)
                         card_update_stepping();
+                else if (strcmp(tag, "biasing") == 0)
+                        card_update_biasing();
                 else {
                         ROAR_ERRNO_FORMAT(&handler, &card_update_sampler,
                             EINVAL, "[%s #%d] invalid key `%s`", card_path,
@@ -498,6 +794,202 @@ static int dump_steps(struct danton_context * context,
         return EXIT_SUCCESS;
 }
 
+/* Thread safe recording of an event to the shared recorder. */
+static int worker_record_event(struct danton_context * context,
+    struct danton_recorder * recorder, const struct danton_event * event)
+{
+        struct worker * w = (struct worker *)((char *)recorder -
+            offsetof(struct worker, recorder));
+        pthread_mutex_lock(&recorder_mutex);
+        const int rc = w->target->record_event(context, w->target, event);
+        pthread_mutex_unlock(&recorder_mutex);
+        return rc;
+}
+
+/* Thread safe recording of a grammage value to the shared recorder. */
+static int worker_record_grammage(struct danton_context * context,
+    struct danton_recorder * recorder, const struct danton_grammage * grammage)
+{
+        struct worker * w = (struct worker *)((char *)recorder -
+            offsetof(struct worker, recorder));
+        pthread_mutex_lock(&recorder_mutex);
+        const int rc =
+            w->target->record_grammage(context, w->target, grammage);
+        pthread_mutex_unlock(&recorder_mutex);
+        return rc;
+}
+
+/* Accumulate the run statistics of a context. */
+static void stats_add(struct danton_context * context)
+{
+        struct danton_stats s;
+        danton_context_stats(context, &s, 0);
+        stats.events += s.events;
+        stats.published += s.published;
+        stats.weight_sum += s.weight_sum;
+        stats.weight_sum2 += s.weight_sum2;
+        int i;
+        for (i = 0; i < DANTON_STAGE_N; i++) {
+                stats.calls[i] += s.calls[i];
+                stats.wall[i] += s.wall[i];
+                stats.cpu[i] += s.cpu[i];
+        }
+}
+
+/* Dump the run statistics in JSON format. */
+static void stats_dump(FILE * stream, double wall, double cpu)
+{
+        const char * stage[DANTON_STAGE_N] = { "ent", "pumas", "medium",
+                "topography", "decay", "recorder" };
+        double mean = 0., sigma = 0.;
+        if (stats.events > 0) {
+                mean = stats.weight_sum / stats.events;
+                const double var = stats.weight_sum2 / stats.events -
+                    mean * mean;
+                if (var > 0.) sigma = sqrt(var / stats.events);
+        }
+        fprintf(stream, "{\n    \"events\": %ld,\n    \"published\": %ld,\n",
+            stats.events, stats.published);
+        fprintf(stream,
+            "    \"weight\": {\"sum\": %.10lE, \"sum2\": %.10lE, "
+            "\"mean\": %.10lE, \"sigma\": %.10lE},\n",
+            stats.weight_sum, stats.weight_sum2, mean, sigma);
+        fprintf(stream, "    \"wall\": %.6lE,\n    \"cpu\": %.6lE,\n", wall,
+            cpu);
+
+        /* The peak resident memory, in kB. */
+        struct rusage usage;
+        long rss = 0;
+        if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+                rss = usage.ru_maxrss / 1024;
+#else
+                rss = usage.ru_maxrss;
+#endif
+        }
+        fprintf(stream, "    \"rss\": %ld,\n", rss);
+        fprintf(stream,
+            "    \"biasing\": {\"decay\": %.6lE, \"grammage\": %.6lE, "
+            "\"recycle\": %.6lE},\n",
+            context->biasing.decay, context->biasing.grammage,
+            context->biasing.recycle);
+        fprintf(stream, "    \"stages\": {\n");
+        int i;
+        for (i = 0; i < DANTON_STAGE_N; i++) {
+                fprintf(stream,
+                    "        \"%s\": {\"calls\": %ld, \"wall\": %.6lE, "
+                    "\"cpu\": %.6lE}%s\n",
+                    stage[i], stats.calls[i], stats.wall[i], stats.cpu[i],
+                    (i < DANTON_STAGE_N - 1) ? "," : "");
+        }
+        fprintf(stream, "    }\n}\n");
+}
+
+/* Entry point of a worker thread. */
+static void * worker_run(void * arg)
+{
+        struct worker * w = arg;
+        w->rc = danton_run(w->context, w->events, w->requested);
+        return NULL;
+}
+
+/* Run the simulation over several threads, each one with its own context. */
+static void run_threads(long events, long requested)
+{
+        if (context->recorder == NULL) {
+                ROAR_ERRNO_MESSAGE(&handler, &run_threads, EINVAL,
+                    "no recorder was provided");
+        }
+
+        workers = calloc(n_threads, sizeof(*workers));
+        if (workers == NULL) {
+                ROAR_ERRNO_MESSAGE(&handler, &run_threads, ENOMEM,
+                    "could not allocate memory");
+        }
+
+        /* Configure the workers, splitting the events among them. The
+         * requested count applies to all workers, through a shared counter.
+         * All workers share the same seed but run disjoint ranges of event
+         * indices, i.e. of random streams. Thus, the generated events do not
+         * depend on the number of threads, provided that ALOUETTE/TAUOLA is
+         * not used, since it has its own global random engine, that all
+         * events are run and that the sequence is not a Latin hypercube.
+         */
+        long published = 0;
+        struct danton_tally tally = { 0, 0, 0., 0. };
+        unsigned long seed;
+        danton_context_random_state(context, &seed, NULL, NULL);
+        long offset = 0;
+        int i;
+        for (i = 0; i < n_threads; i++) {
+                struct worker * w = workers + i;
+                w->context = danton_context_create();
+                if (w->context == NULL) {
+                        ROAR_ERRWP_MESSAGE(&handler, &run_threads, -1,
+                            "danton error", danton_error_pop(NULL));
+                }
+                w->context->mode = context->mode;
+                w->context->longitudinal = context->longitudinal;
+                w->context->decay = context->decay;
+                w->context->biasing = context->biasing;
+                w->context->sequence = context->sequence;
+                w->context->precision = context->precision;
+                w->context->time_limit = context->time_limit;
+                danton_context_seed(w->context, &seed);
+                int j;
+                for (j = 0; j < DANTON_PARTICLE_N_NU; j++)
+                        w->context->primary[j] = context->primary[j];
+
+                w->context->sampler = danton_sampler_create();
+                if (w->context->sampler == NULL) {
+                        ROAR_ERRWP_MESSAGE(&handler, &run_threads, -1,
+                            "danton error", danton_error_pop(NULL));
+                }
+                *w->context->sampler = *context->sampler;
+                if (danton_sampler_update(w->context->sampler) !=
+                    EXIT_SUCCESS) {
+                        ROAR_ERRWP_MESSAGE(&handler, &run_threads, -1,
+                            "danton error", danton_error_pop(NULL));
+                }
+
+                w->recorder.record_event = &worker_record_event;
+                w->recorder.record_grammage = &worker_record_grammage;
+                w->target = context->recorder;
+                w->context->recorder = &w->recorder;
+
+                w->context->published = &published;
+                w->context->tally = &tally;
+                w->events = events / n_threads + (i < events % n_threads);
+                w->requested = requested;
+                w->context->event_offset = offset;
+                offset += w->events;
+        }
+
+        /* Run the workers and wait for their completion. */
+        int n_started;
+        for (n_started = 0; n_started < n_threads; n_started++) {
+                struct worker * w = workers + n_started;
+                if (pthread_create(&w->thread, NULL, &worker_run, w) != 0)
+                        break;
+        }
+        for (i = 0; i < n_started; i++) pthread_join(workers[i].thread, NULL);
+        if (n_started < n_threads) {
+                ROAR_ERRNO_MESSAGE(&handler, &run_threads, EAGAIN,
+                    "could not create thread");
+        }
+
+        /* Check for any error. */
+        for (i = 0; i < n_threads; i++) {
+                if (workers[i].rc != EXIT_SUCCESS) {
+                        ROAR_ERRWP_MESSAGE(&handler, &run_threads, -1,
+                            "danton error",
+                            danton_error_pop(workers[i].context));
+                }
+                stats_add(workers[i].context);
+        }
+        workers_destroy();
+}
+
 int main(int argc, char * argv[])
 {
         /* Configure the error handler. */
@@ -510,8 +1002,11 @@ int main(int argc, char * argv[])
          */
         if (argc <= 1) exit_with_help(EXIT_SUCCESS);
 
-        /* Initialise DANTON. */
-        if (danton_initialise(NULL, NULL, NULL, NULL, NULL) != EXIT_SUCCESS) {
+        /* Initialise DANTON. Locks are always provided since the number of
+         * threads is only known once the data card(s) have been parsed.
+         */
+        if (danton_initialise(NULL, NULL, NULL, &danton_lock,
+                &danton_unlock) != EXIT_SUCCESS) {
                 ROAR_ERRWP_MESSAGE(&handler, &main, -1, "danton error",
                     danton_error_pop(NULL));
         }
@@ -523,15 +1018,43 @@ int main(int argc, char * argv[])
                     danton_error_pop(NULL));
         }
 
-        /* Set the input arguments from the JSON card(s). */
-        int n_events = 10000, n_requested = 0;
+        /* Set the input arguments from the command line and from the JSON
+         * card(s).
+         */
+        int n_events = 10000, n_requested = 0, threads_option = 0;
         for (argv++; *argv != NULL; argv++) {
+                if (strcmp(*argv, "--stats") == 0) {
+                        stats_option = 1;
+                        continue;
+                }
+                if (strncmp(*argv, "-j", 2) == 0) {
+                        const char * nptr = (*argv)[2] ? *argv + 2 : *++argv;
+                        char * endptr = NULL;
+                        if (nptr != NULL)
+                                threads_option = strtol(nptr, &endptr, 10);
+                        if ((nptr == NULL) || (*endptr != 0x0) ||
+                            (threads_option <= 0))
+                                exit_with_help(EXIT_FAILURE);
+                        continue;
+                }
                 tea = jsmn_tea_create(*argv, JSMN_TEA_MODE_LOAD, &handler);
                 card_path = *argv;
                 card_update(&n_events, &n_requested);
                 jsmn_tea_destroy(&tea);
         }
 
+        /* Check the number of threads. */
+        if (threads_option > 0) n_threads = threads_option;
+        if (n_threads <= 0) {
+                ROAR_ERRNO_FORMAT(&handler, &main, EINVAL,
+                    "invalid number of threads (%d)", n_threads);
+        }
+        if (context->mode == DANTON_MODE_GRAMMAGE) n_threads = 1;
+        if ((n_threads > 1) && (stepping_options.path != NULL)) {
+                ROAR_ERRNO_MESSAGE(&handler, &main, EINVAL,
+                    "stepping is not supported with multiple threads");
+        }
+
         /* Initialise any stepping dump. */
         if (stepping_options.path != NULL) {
                 context->run_action = &dump_steps;
@@ -549,10 +1072,33 @@ int main(int argc, char * argv[])
                     danton_error_pop(NULL));
         }
 
+        /* Tune the biasing, before splitting the run over several threads. */
+        if ((biasing_tune > 0) && (context->mode == DANTON_MODE_BACKWARD) &&
+            (danton_biasing_tune(context, biasing_tune) != EXIT_SUCCESS)) {
+                ROAR_ERRWP_MESSAGE(&handler, &main, -1, "danton error",
+                    danton_error_pop(context));
+        }
+
         /* Run the simulation. */
-        if (danton_run(context, n_events, n_requested) != EXIT_SUCCESS)
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        const clock_t c0 = clock();
+        if (n_threads > 1)
+                run_threads(n_events, n_requested);
+        else if (danton_run(context, n_events, n_requested) != EXIT_SUCCESS)
                 ROAR_ERRWP_MESSAGE(&handler, &main, -1, "danton error",
                     danton_error_pop(context));
+        else
+                stats_add(context);
+
+        /* Dump any run statistics. */
+        if (stats_option) {
+                clock_gettime(CLOCK_MONOTONIC, &t1);
+                const double wall = (t1.tv_sec - t0.tv_sec) +
+                    1E-09 * (t1.tv_nsec - t0.tv_nsec);
+                const double cpu = (clock() - c0) / (double)CLOCKS_PER_SEC;
+                stats_dump(stderr, wall, cpu);
+        }
 
         /* Finalise and exit to the OS. */
         gracefully_exit(EXIT_SUCCESS);
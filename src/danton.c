@@ -19,15 +19,27 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 
+/* Enable POSIX features, for the cache of the physics tables. */
+#define _POSIX_C_SOURCE 200809L
+
 /* Standard library includes. */
 #include <errno.h>
 #include <float.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <math.h>
 #include <stdarg.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+/* POSIX includes. */
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 /* The various APIs. */
 #include "alouette.h"
@@ -49,8 +61,14 @@
 /* Avogadro's number. */
 #define PHYS_NA 6.022E+23
 
-/* Biasing factor for backward tau decays. */
-#define DECAY_BIAS 6.
+/* The dimensions of the generation of backward events. */
+enum sequence_dimension {
+        SEQUENCE_ELEVATION = 0,
+        SEQUENCE_AZIMUTH,
+        SEQUENCE_ENERGY,
+        SEQUENCE_ALTITUDE,
+        SEQUENCE_N
+};
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
@@ -64,6 +82,9 @@ static char * pdf_path = NULL;
 static char * mdf_path = NULL;
 static char * dedx_path = NULL;
 
+/* Path to the cache directory for the PUMAS tables. */
+static char * cache_path = NULL;
+
 /* The tau lepton mass, in GeV / c^2. */
 static double tau_mass;
 
@@ -163,14 +184,14 @@ static double space_model0(double x, double * density)
         return 0.;
 }
 
-/* Structure for storing the data relative to the sampled events. */
+/* Structure for storing the data relative to the sampled events. The decay
+ * products are stored in the arena of the simulation context.
+ */
 struct event_record {
         struct danton_event api;
         struct danton_state primary;
         struct danton_state vertex;
         struct danton_state final;
-        int buffer_size;
-        struct danton_product product[];
 };
 
 /* Container for error message(s). */
@@ -181,6 +202,11 @@ struct error_stack {
         char data[ERROR_SIZE];
 };
 
+/* Maximum number of products for a tau decay. */
+#define DECAY_PRODUCTS_MAX 16
+
+struct run_state;
+
 /* Container for contextual simulation data. */
 struct simulation_context {
         /* Public API data. */
@@ -192,9 +218,41 @@ struct simulation_context {
 
         struct turtle_client * client;
 
-        /* Recorded events. */
+        /* Cache of the ground elevation over the last visited cell of the
+         * topography, with the elevation values at its corners.
+         */
+        struct {
+                unsigned long version;
+                long ix;
+                long iy;
+                double z[2][2];
+        } elevation;
+
+        /* The current event record. */
         struct event_record * record;
 
+        /* Arena of event records. The current record is the n-th one. The
+         * decay products of successive records are stored contiguously, and
+         * there is always room for the products of a tau decay after the
+         * ones of the current record. When events are pulled by batches,
+         * published records are accumulated in the arena. Otherwise, the
+         * first record is reused.
+         */
+        struct {
+                int batch;
+                long n;
+                long size;
+                long consumed;
+                long consumed_products;
+                struct event_record * records;
+                long n_products;
+                long products_size;
+                struct danton_product * products;
+        } arena;
+
+        /* State of the current run. */
+        struct run_state * run;
+
         /* The lower (upper) energy bound under (above) which all particles are
          * killed.
          */
@@ -203,16 +261,106 @@ struct simulation_context {
         /* Flag to check if the neutrino flux is requested. */
         int flux_neutrino;
 
-        /* Data for the Mersenne Twister PRNG. */
+        /* Counter for the number of published events. */
+        long n_published;
+
+        /* Sums of the weights, and of their squares, of the events published
+         * during the current run.
+         */
+        double weight_sum;
+        double weight_sum2;
+
+        /* Flag for trial runs, when tuning the biasing. Events are not
+         * published during trials.
+         */
+        int tuning;
+
+        /* Cumulated run statistics. */
+        struct danton_stats stats;
+
+        /* The requested number of published events, and any counter shared
+         * with other contexts for the current run.
+         */
+        long requested;
+        long * shared_published;
+
+        /* Data for the Philox counter-based PRNG. The stream is the index of
+         * the current event and the index counts the draws within it.
+         */
+        struct {
+                unsigned long seed;
+                unsigned long stream;
+                unsigned long index;
+                uint32_t buffer[4];
+        } random;
+
+        /* Sequence for the generation of backward events, with the number
+         * of events of the run, the scrambling of each dimension and the
+         * direction numbers of the Sobol sequence.
+         */
         struct {
-#define MT_PERIOD 624
+                enum danton_sequence type;
+                long events;
+                uint32_t scramble[SEQUENCE_N];
+                uint32_t direction[SEQUENCE_N][32];
+        } sequence;
+
+        /* Stack of secondary particles pending for transport. */
+        struct {
+                int n;
+                int size;
+                struct transport_item * items;
+        } stack;
+
+        /* Products of the last tau decay. */
+        struct {
+                int n;
                 int index;
-                unsigned long data[MT_PERIOD];
-        } random_mt;
+                int pid[DECAY_PRODUCTS_MAX];
+                double momentum[DECAY_PRODUCTS_MAX][3];
+        } decay;
 
         struct error_stack error;
 };
 
+#ifdef DANTON_STATS
+/* Timer for the per stage statistics. */
+struct stats_timer {
+        struct timespec wall;
+        struct timespec cpu;
+};
+
+/* Start a timer. */
+static void stats_start(struct stats_timer * timer)
+{
+        clock_gettime(CLOCK_MONOTONIC, &timer->wall);
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &timer->cpu);
+}
+
+/* Stop a timer and account for the elapsed time. */
+static void stats_stop(struct simulation_context * context,
+    enum danton_stage stage, const struct stats_timer * timer)
+{
+        struct timespec wall, cpu;
+        clock_gettime(CLOCK_MONOTONIC, &wall);
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+        context->stats.calls[stage]++;
+        context->stats.wall[stage] += (wall.tv_sec - timer->wall.tv_sec) +
+            1E-09 * (wall.tv_nsec - timer->wall.tv_nsec);
+        context->stats.cpu[stage] += (cpu.tv_sec - timer->cpu.tv_sec) +
+            1E-09 * (cpu.tv_nsec - timer->cpu.tv_nsec);
+}
+
+#define STATS_START(timer)                                                     \
+        struct stats_timer timer;                                              \
+        stats_start(&timer)
+#define STATS_STOP(context, stage, timer) stats_stop(context, stage, &timer)
+#else
+/* Without the DANTON_STATS flag only the calls are counted. */
+#define STATS_START(timer) (void)0
+#define STATS_STOP(context, stage, timer) (context)->stats.calls[stage]++
+#endif
+
 /* Get the full simulation context from the PUMAS' one. */
 static struct simulation_context * pumas2context(struct pumas_context * context)
 {
@@ -241,6 +389,16 @@ struct generic_state {
         int is_inside;
         int has_crossed;
         int cross_count;
+        /* Geometry data cached by the medium callback. */
+        int layer;
+        double a;
+        double direction[3];
+};
+
+/* Work item for the transport of secondary particles. */
+struct transport_item {
+        struct generic_state state;
+        int generation;
 };
 
 /* Supported geodesics for the Earth model */
@@ -256,7 +414,11 @@ static struct {
         int material;
         double density;
         int sea;
-} earth = { EARTH_GEODESIC_PREM, NULL, 16, 0., 1, 0, 2.65E+03, 1 };
+        /* The grid spacing of the topography data, in deg, or zero. */
+        double grid;
+        /* Version counter of the model, for invalidating cached data. */
+        unsigned long version;
+} earth = { EARTH_GEODESIC_PREM, NULL, 16, 0., 1, 0, 2.65E+03, 1, 0., 0 };
 
 /* API function for accessing the datum. */
 void * danton_get_datum(void) { return earth.datum; }
@@ -369,14 +531,28 @@ static void compute_ecef_position(
         }
 }
 
-/* Helper function for computing ECEF direction from horizontal angular
- * coordinates.
+/* Precomputed local frame of an event sampler. */
+struct sampler_frame {
+        /* The Earth geodesic for which the frame was computed. */
+        enum earth_geodesic geodesic;
+        /* ECEF position at the sampler location, for a null altitude. */
+        double origin[3];
+        /* ECEF displacement per unit of altitude. */
+        double lift[3];
+        /* Rotation matrix from local to ECEF coordinates. */
+        double R[3][3];
+};
+
+/* Compute the local frame at the sampler location, according to the current
+ * Earth geodesic. Note that for a spherical Earth the altitude is ignored,
+ * consistently with `compute_ecef_position`.
  */
-static void compute_ecef_direction(
-    double latitude, double longitude, double azimuth, double c, double * ecef)
+static void sampler_frame_compute(
+    double latitude, double longitude, struct sampler_frame * frame)
 {
+        frame->geodesic = earth.geodesic;
+        compute_ecef_position(latitude, longitude, 0., frame->origin);
         if (earth.geodesic == EARTH_GEODESIC_PREM) {
-                /* Compute the rotation matrix from local to ECEF. */
                 const double deg = M_PI / 180.;
                 const double theta = (90. - latitude) * deg;
                 const double phi = longitude * deg;
@@ -385,25 +561,55 @@ static void compute_ecef_direction(
                 const double sp = sin(phi);
                 const double cp = cos(phi);
 
-                const double R[3][3] = { { -sp, cp, 0. },
-                        { ct * cp, ct * sp, -st }, { st * cp, st * sp, ct } };
-
-                /* Compute the local direction. */
-                const double p = (90. - azimuth) * deg;
-                const double s = sqrt(1. - c * c);
-                const double u[3] = { s * cos(p), s * sin(p), c };
-
-                /* Apply the rotation. */
-                ecef[0] = R[0][0] * u[0] + R[1][0] * u[1] + R[2][0] * u[2];
-                ecef[1] = R[0][1] * u[0] + R[1][1] * u[1] + R[2][1] * u[2];
-                ecef[2] = R[0][2] * u[0] + R[1][2] * u[1] + R[2][2] * u[2];
+                memset(frame->lift, 0x0, sizeof(frame->lift));
+                frame->R[0][0] = -sp;
+                frame->R[0][1] = cp;
+                frame->R[0][2] = 0.;
+                frame->R[1][0] = ct * cp;
+                frame->R[1][1] = ct * sp;
+                frame->R[1][2] = -st;
+                frame->R[2][0] = st * cp;
+                frame->R[2][1] = st * sp;
+                frame->R[2][2] = ct;
         } else {
-                const double elevation = 90. - acos(c) / M_PI * 180.;
+                /* The geodetic altitude is along the local vertical. */
+                turtle_datum_direction(earth.datum, latitude, longitude, 90.,
+                    0., frame->R[0]);
                 turtle_datum_direction(
-                    earth.datum, latitude, longitude, azimuth, elevation, ecef);
+                    earth.datum, latitude, longitude, 0., 0., frame->R[1]);
+                turtle_datum_direction(
+                    earth.datum, latitude, longitude, 0., 90., frame->R[2]);
+                memcpy(frame->lift, frame->R[2], sizeof(frame->lift));
         }
 }
 
+/* Compute the ECEF position at the given altitude from a sampler frame. */
+static void sampler_frame_position(
+    const struct sampler_frame * frame, double altitude, double * ecef)
+{
+        ecef[0] = frame->origin[0] + altitude * frame->lift[0];
+        ecef[1] = frame->origin[1] + altitude * frame->lift[1];
+        ecef[2] = frame->origin[2] + altitude * frame->lift[2];
+}
+
+/* Compute the ECEF direction from horizontal angular coordinates, using a
+ * sampler frame.
+ */
+static void sampler_frame_direction(const struct sampler_frame * frame,
+    double azimuth, double c, double * ecef)
+{
+        /* Compute the local direction. */
+        const double p = (90. - azimuth) * M_PI / 180.;
+        const double s = sqrt(1. - c * c);
+        const double u[3] = { s * cos(p), s * sin(p), c };
+
+        /* Apply the rotation. */
+        const double(*R)[3] = frame->R;
+        ecef[0] = R[0][0] * u[0] + R[1][0] * u[1] + R[2][0] * u[2];
+        ecef[1] = R[0][1] * u[0] + R[1][1] * u[1] + R[2][1] * u[2];
+        ecef[2] = R[0][2] * u[0] + R[1][2] * u[1] + R[2][2] * u[2];
+}
+
 /* Get the parameters for computing the intersection with the ellipsoid. */
 static void ellipsoid_parameters_intersection(const double * position,
     const double * direction, double * a, double * b, double * r2)
@@ -428,6 +634,121 @@ static void ellipsoid_parameters_intersection(const double * position,
         *b = rx * ux + ry * uy + rz * uz;
 }
 
+/* Squared radii of the geometry layers, in units of the Earth radius. */
+#define LAYER_RADIUS2(r) (((r) / PREM_EARTH_RADIUS) * ((r) / PREM_EARTH_RADIUS))
+static const double layer_radius2[] = { LAYER_RADIUS2(1221.5E+03),
+        LAYER_RADIUS2(3480.E+03), LAYER_RADIUS2(5701.E+03),
+        LAYER_RADIUS2(5771.E+03), LAYER_RADIUS2(5971.E+03),
+        LAYER_RADIUS2(6151.E+03), LAYER_RADIUS2(6346.6E+03),
+        LAYER_RADIUS2(6356.E+03), LAYER_RADIUS2(6368.E+03),
+        LAYER_RADIUS2(PREM_EARTH_RADIUS),
+        LAYER_RADIUS2(PREM_EARTH_RADIUS + 4.E+03),
+        LAYER_RADIUS2(PREM_EARTH_RADIUS + 1.E+04),
+        LAYER_RADIUS2(PREM_EARTH_RADIUS + 4.E+04),
+        LAYER_RADIUS2(PREM_EARTH_RADIUS + 1.E+05), LAYER_RADIUS2(GEO_ORBIT) };
+#undef LAYER_RADIUS2
+
+#define N_LAYERS (int)(sizeof(layer_radius2) / sizeof(*layer_radius2))
+
+/* Locate the innermost layer enclosing the squared radius r2, or return
+ * N_LAYERS - 1 if none. The search starts from the layer of the previous
+ * step, since consecutive steps seldom cross more than one boundary.
+ */
+static int layer_locate(double r2, int layer)
+{
+        if (layer < 0)
+                layer = 0;
+        else if (layer > N_LAYERS - 1)
+                layer = N_LAYERS - 1;
+        while ((layer > 0) && (r2 <= layer_radius2[layer - 1])) layer--;
+        while ((layer < N_LAYERS - 1) && (r2 > layer_radius2[layer])) layer++;
+        return layer;
+}
+
+/* Get the ground elevation from TURTLE. On failure, the elevation is set to
+ * zero.
+ */
+static int topography_elevation_raw(struct simulation_context * context,
+    double latitude, double longitude, double * z)
+{
+        enum turtle_return rc;
+        STATS_START(timer);
+        if (lock != NULL)
+                rc = turtle_client_elevation(
+                    context->client, latitude, longitude, z);
+        else
+                rc = turtle_datum_elevation(
+                    earth.datum, latitude, longitude, z);
+        STATS_STOP(context, DANTON_STAGE_TOPOGRAPHY, timer);
+        if (rc == TURTLE_RETURN_SUCCESS) return EXIT_SUCCESS;
+        *z = 0.;
+        return EXIT_FAILURE;
+}
+
+/* Get the ground elevation, using the cached cell if possible. The cells
+ * match the grid of the elevation data, if provided. Over a cell, the
+ * elevation is bilinearly interpolated from its corners, as done by TURTLE.
+ * If no grid was provided, or if the elevation at any corner is not
+ * available, TURTLE is queried directly.
+ */
+static double topography_elevation(
+    struct simulation_context * context, double latitude, double longitude)
+{
+        double zi;
+        const double cell = earth.grid;
+        if (cell <= 0.) {
+                topography_elevation_raw(context, latitude, longitude, &zi);
+                return zi;
+        }
+
+        const double x = longitude / cell;
+        const double y = latitude / cell;
+        const long ix = (long)floor(x);
+        const long iy = (long)floor(y);
+
+        if ((context->elevation.version != earth.version) ||
+            (ix != context->elevation.ix) || (iy != context->elevation.iy)) {
+                /* Update the cached corners, reusing the ones shared with the
+                 * previous cell, if any.
+                 */
+                const int valid = context->elevation.version == earth.version;
+                const long ix0 = context->elevation.ix;
+                const long iy0 = context->elevation.iy;
+                double z0[2][2];
+                memcpy(z0, context->elevation.z, sizeof(z0));
+                context->elevation.version = earth.version - 1;
+                int i, j;
+                for (i = 0; i < 2; i++) {
+                        for (j = 0; j < 2; j++) {
+                                const long dx = ix + i - ix0;
+                                const long dy = iy + j - iy0;
+                                if (valid && (dx >= 0) && (dx <= 1) &&
+                                    (dy >= 0) && (dy <= 1))
+                                        context->elevation.z[i][j] =
+                                            z0[dx][dy];
+                                else if (topography_elevation_raw(context,
+                                             (iy + j) * cell, (ix + i) * cell,
+                                             &context->elevation.z[i][j]) !=
+                                    EXIT_SUCCESS) {
+                                        /* Leave the cache invalid. */
+                                        topography_elevation_raw(context,
+                                            latitude, longitude, &zi);
+                                        return zi;
+                                }
+                        }
+                }
+                context->elevation.version = earth.version;
+                context->elevation.ix = ix;
+                context->elevation.iy = iy;
+        }
+
+        const double u = x - ix;
+        const double v = y - iy;
+        double(*z)[2] = context->elevation.z;
+        return (1. - u) * ((1. - v) * z[0][0] + v * z[0][1]) +
+            u * ((1. - v) * z[1][0] + v * z[1][1]);
+}
+
 /* Generic medium callback. */
 static double medium(const double * position, const double * direction,
     struct generic_state * state)
@@ -435,10 +756,35 @@ static double medium(const double * position, const double * direction,
         state->medium = -1;
         double step = 0.;
 
+        /* Compute the intersection parameters. The direction dependent term
+         * is reused as long as the direction does not change, e.g. along
+         * straight neutrino segments.
+         */
         double a, b, r2;
-        ellipsoid_parameters_intersection(position, direction, &a, &b, &r2);
-        const double rmax = GEO_ORBIT / PREM_EARTH_RADIUS;
-        if (r2 > rmax * rmax) return step;
+        if ((state->a > 0.) && (direction[0] == state->direction[0]) &&
+            (direction[1] == state->direction[1]) &&
+            (direction[2] == state->direction[2])) {
+                double ai, bi;
+                if (earth.geodesic == EARTH_GEODESIC_PREM) {
+                        ai = bi = 1. / PREM_EARTH_RADIUS;
+                } else {
+                        ai = 1. / WGS84_RADIUS_A;
+                        bi = 1. / WGS84_RADIUS_B;
+                }
+                const double rx = ai * position[0];
+                const double ry = ai * position[1];
+                const double rz = bi * position[2];
+                r2 = rx * rx + ry * ry + rz * rz;
+                a = state->a;
+                b = ai * (rx * direction[0] + ry * direction[1]) +
+                    bi * rz * direction[2];
+        } else {
+                ellipsoid_parameters_intersection(
+                    position, direction, &a, &b, &r2);
+                state->a = a;
+                memcpy(state->direction, direction, sizeof(state->direction));
+        }
+        if (r2 > layer_radius2[N_LAYERS - 1]) return step;
         const double r = sqrt(r2);
         state->x = r;
 
@@ -456,47 +802,33 @@ static double medium(const double * position, const double * direction,
                 }
         };
 
-        const double ri[] = { 1221.5E+03 / PREM_EARTH_RADIUS,
-                3480.E+03 / PREM_EARTH_RADIUS, 5701.E+03 / PREM_EARTH_RADIUS,
-                5771.E+03 / PREM_EARTH_RADIUS, 5971.E+03 / PREM_EARTH_RADIUS,
-                6151.E+03 / PREM_EARTH_RADIUS, 6346.6E+03 / PREM_EARTH_RADIUS,
-                6356.E+03 / PREM_EARTH_RADIUS, 6368.E+03 / PREM_EARTH_RADIUS,
-                1., 1. + 4.E+03 / PREM_EARTH_RADIUS,
-                1. + 1.E+04 / PREM_EARTH_RADIUS,
-                1. + 4.E+04 / PREM_EARTH_RADIUS,
-                1. + 1.E+05 / PREM_EARTH_RADIUS,
-                GEO_ORBIT / PREM_EARTH_RADIUS };
-
         /* Kill neutrinos that exit the atmosphere.  */
-        if ((!state->is_tau) && (state->x > ri[13])) return step;
+        if ((!state->is_tau) && (r2 > layer_radius2[13])) return step;
 
-        int i;
-        for (i = 0; i < sizeof(ri) / sizeof(*ri) - 1; i++) {
-                if (r <= ri[i]) {
-                        state->medium = i;
-
-                        /* Outgoing intersection. */
-                        const double d2 = b * b + a * (ri[i] * ri[i] - r2);
-                        const double d = (d2 <= 0.) ? 0. : sqrt(d2);
-                        step = (d - b) / a;
-
-                        if ((i > 0) && (b < 0.)) {
-                                /* This is a downgoing trajectory. Let
-                                 * us compute the intersection with the lower
-                                 * radius.
-                                 */
-                                const double r1 = ri[i - 1];
-                                const double d2 = b * b + a * (r1 * r1 - r * r);
-                                if (d2 > 0.) {
-                                        const double d = sqrt(d2);
-                                        double s = -(b + d) / a;
-                                        if ((s > 0.) && (s < step)) step = s;
-                                }
-                        }
+        const int i = state->layer = layer_locate(r2, state->layer);
 #define STEP_MIN 1E-03
-                        if (step < STEP_MIN) step = STEP_MIN;
-                        break;
+        if (i < N_LAYERS - 1) {
+                state->medium = i;
+
+                /* Outgoing intersection. */
+                const double d2 = b * b + a * (layer_radius2[i] - r2);
+                const double d = (d2 <= 0.) ? 0. : sqrt(d2);
+                step = (d - b) / a;
+
+                if ((i > 0) && (b < 0.)) {
+                        /* This is a downgoing trajectory. Let
+                         * us compute the intersection with the lower
+                         * radius.
+                         */
+                        const double d2 =
+                            b * b + a * (layer_radius2[i - 1] - r2);
+                        if (d2 > 0.) {
+                                const double d = sqrt(d2);
+                                double s = -(b + d) / a;
+                                if ((s > 0.) && (s < step)) step = s;
+                        }
                 }
+                if (step < STEP_MIN) step = STEP_MIN;
         }
 
 /* Check for any topography. */
@@ -509,20 +841,9 @@ static double medium(const double * position, const double * direction,
         if ((altitude < 0.) && !earth.sea) return step;
 
         /* Let us compute the ground altitude. */
-        double zg;
-        if (earth.is_flat)
-                zg = earth.z0;
-        else {
-                enum turtle_return rc;
-                if (lock != NULL) {
-                        rc = turtle_client_elevation(
-                            state->context->client, latitude, longitude, &zg);
-                } else {
-                        rc = turtle_datum_elevation(
-                            earth.datum, latitude, longitude, &zg);
-                }
-                if (rc != TURTLE_RETURN_SUCCESS) zg = 0.;
-        }
+        const double zg = earth.is_flat ?
+            earth.z0 :
+            topography_elevation(state->context, latitude, longitude);
 
         /* Let us update the medium index accordingly. */
         double s = altitude - zg;
@@ -575,7 +896,9 @@ static double medium_ent(struct ent_context * context, struct ent_state * state,
                 direction[2] = state->direction[2];
         }
         struct generic_state * g = (struct generic_state *)state;
+        STATS_START(timer);
         const double step = medium(state->position, direction, g);
+        STATS_STOP(g->context, DANTON_STAGE_MEDIUM, timer);
         if (g->medium == MEDIUM_TOPOGRAPHY)
                 *medium_ptr = &topography_ent;
         else if (g->medium >= 0)
@@ -631,6 +954,164 @@ static void earth_model_configure(void)
 #undef ZW
 #undef AW
 
+/* Polynomial coefficients of the PEM densities above, in kg / m^3, versus the
+ * reduced radius x.
+ */
+static const double pem_coefficients[][4] = {
+        { 13.0885E+03, 0., -8.8381E+03, 0. },
+        { 12.58155E+03, -1.2638E+03, -3.6426E+03, -5.5281E+03 },
+        { 7.9565E+03, -6.4761E+03, 5.5283E+03, -3.0807E+03 },
+        { 5.3197E+03, -1.4836E+03, 0., 0. },
+        { 11.2494E+03, -8.0298E+03, 0., 0. },
+        { 7.1089E+03, -3.8045E+03, 0., 0. }, { 2.691E+03, 0.6924E+03, 0., 0. },
+        { 2.9E+03, 0., 0., 0. }, { 2.6E+03, 0., 0., 0. },
+        { 1.02E+03, 0., 0., 0. }
+};
+
+/* Parameters B and C of the U.S. standard atmosphere model above. */
+static const double uss_coefficients[][2] = { { 12226.562, 9941.8638 },
+        { 11449.069, 8781.5355 }, { 13055.948, 6361.4304 },
+        { 5401.778, 7721.7016 } };
+
+/* Primitive of a PEM density along a straight line, at the abscissa t from
+ * the closest approach point. The squared reduced radius is t^2 + h2.
+ */
+static double grammage_pem(const double * c, double h2, double t)
+{
+        const double x2 = t * t + h2;
+        const double x = sqrt(x2);
+        double L = 0.;
+        if (h2 > 0.) L = (t >= 0.) ? log(t + x) : log(h2 / (x - t));
+
+        const double I1 = 0.5 * (t * x + h2 * L);
+        const double I2 = t * (t * t / 3. + h2);
+        const double I3 = 0.125 * (t * x * (2. * x2 + 3. * h2) +
+                                      3. * h2 * h2 * L);
+        return c[0] * t + c[1] * I1 + c[2] * I2 + c[3] * I3;
+}
+
+/* Integral of the U.S. standard atmosphere density along a straight line,
+ * between the abscissa ta and tb. A 6 points Gauss-Legendre quadrature is
+ * used over sub-intervals along which the density changes by less than a
+ * factor e.
+ */
+static double grammage_uss(const double * bc, double h2, double ta, double tb)
+{
+        if ((ta < 0.) && (tb > 0.))
+                return grammage_uss(bc, h2, ta, 0.) +
+                    grammage_uss(bc, h2, 0., tb);
+
+        static const double xg[] = { 0.2386191860831969, 0.6612093864662645,
+                0.9324695142031521 };
+        static const double wg[] = { 0.4679139345726910, 0.3607615730481386,
+                0.1713244923791704 };
+
+        const double lambda = PREM_EARTH_RADIUS / bc[1];
+        const double xa = sqrt(ta * ta + h2);
+        const double xb = sqrt(tb * tb + h2);
+        int n = (int)ceil(fabs(xb - xa) * lambda);
+        if (n < 1) n = 1;
+        const double sgn = (ta + tb >= 0.) ? 1. : -1.;
+
+        double grammage = 0., t0 = ta;
+        int i;
+        for (i = 1; i <= n; i++) {
+                double t1;
+                if (i == n)
+                        t1 = tb;
+                else {
+                        const double x = xa + (xb - xa) * i / n;
+                        const double d = x * x - h2;
+                        t1 = (d > 0.) ? sgn * sqrt(d) : 0.;
+                }
+
+                const double hw = 0.5 * (t1 - t0);
+                const double tc = 0.5 * (t1 + t0);
+                int j;
+                for (j = 0; j < 3; j++) {
+                        const double dt = hw * xg[j];
+                        const double x0 = sqrt((tc - dt) * (tc - dt) + h2);
+                        const double x1 = sqrt((tc + dt) * (tc + dt) + h2);
+                        grammage += hw * wg[j] *
+                            (exp(-(x0 - 1.) * lambda) +
+                                exp(-(x1 - 1.) * lambda));
+                }
+                t0 = t1;
+        }
+        return grammage * bc[0] / bc[1];
+}
+
+/* Check if the grammage can be computed analytically, i.e. for a spherical
+ * Earth without topography.
+ */
+static int grammage_is_analytic(void)
+{
+        return (earth.geodesic == EARTH_GEODESIC_PREM) && earth.is_flat &&
+            (earth.z0 == 0.);
+}
+
+/* Compute the grammage along a straight line, from the given position up to
+ * the top of the atmosphere. The Earth is assumed to be spherical, without
+ * topography, see `grammage_is_analytic`.
+ */
+static double grammage_compute(
+    const double * position, const double * direction)
+{
+        /* Compute the line parameters, in units of the Earth radius. */
+        const double u2 = direction[0] * direction[0] +
+            direction[1] * direction[1] + direction[2] * direction[2];
+        const double ri = 1. / PREM_EARTH_RADIUS;
+        const double x02 = ri * ri *
+            (position[0] * position[0] + position[1] * position[1] +
+                position[2] * position[2]);
+        const double xmax2 = layer_radius2[13];
+        if (x02 > xmax2) return 0.;
+        const double beta = ri / sqrt(u2) *
+            (position[0] * direction[0] + position[1] * direction[1] +
+                position[2] * direction[2]);
+        double h2 = x02 - beta * beta;
+        if (h2 < 0.) h2 = 0.;
+        const double tmax = sqrt(xmax2 - h2);
+
+        /* Build the ordered list of layers boundaries along the line. */
+        double boundary[2 * 14 + 1];
+        int n = 0, i;
+        for (i = 13; i >= 0; i--) {
+                if (layer_radius2[i] > h2)
+                        boundary[n++] = -sqrt(layer_radius2[i] - h2);
+        }
+        boundary[n++] = 0.;
+        for (i = 0; i <= 13; i++) {
+                if (layer_radius2[i] > h2)
+                        boundary[n++] = sqrt(layer_radius2[i] - h2);
+        }
+
+        /* Integrate the density over the crossed layers. */
+        double grammage = 0., t0 = beta;
+        int layer = 9;
+        for (i = 0; (i < n) && (t0 < tmax); i++) {
+                if (boundary[i] <= t0) continue;
+                const double t1 = (boundary[i] < tmax) ? boundary[i] : tmax;
+                const double tm = 0.5 * (t0 + t1);
+                layer = layer_locate(tm * tm + h2, layer);
+                if (layer < 9) {
+                        const double * c = pem_coefficients[layer];
+                        grammage +=
+                            grammage_pem(c, h2, t1) - grammage_pem(c, h2, t0);
+                } else if (layer == 9) {
+                        const double density = earth.sea ?
+                            pem_coefficients[9][0] :
+                            pem_coefficients[8][0];
+                        grammage += density * (t1 - t0);
+                } else {
+                        grammage += grammage_uss(
+                            uss_coefficients[layer - 10], h2, t0, t1);
+                }
+                t0 = t1;
+        }
+        return grammage * PREM_EARTH_RADIUS;
+}
+
 /* Medium callback encapsulation for PUMAS. */
 static double medium_pumas(struct pumas_context * context,
     struct pumas_state * state, struct pumas_medium ** medium_ptr)
@@ -646,7 +1127,9 @@ static double medium_pumas(struct pumas_context * context,
                 direction[2] = -state->direction[2];
         }
         struct generic_state * g = (struct generic_state *)state;
+        STATS_START(timer);
         const double step = medium(state->position, direction, g);
+        STATS_STOP(g->context, DANTON_STAGE_MEDIUM, timer);
         if (g->medium == MEDIUM_TOPOGRAPHY)
                 *medium_ptr = &topography_pumas;
         else if (g->medium >= 0)
@@ -673,78 +1156,73 @@ static int random_get_seed(unsigned long * seed)
         return EXIT_SUCCESS;
 }
 
-/* Initialise the PRNG random seed. */
-static void random_initialise(struct simulation_context * context)
+/* Set the seed of the PRNG, and reset its stream. */
+static void random_seed(struct simulation_context * context, unsigned long seed)
 {
-        /* Get a seed from /dev/urandom*/
-        unsigned long seed;
-        if (random_get_seed(&seed) != EXIT_SUCCESS) goto error;
+        context->random.seed = seed;
+        context->random.stream = 0;
+        context->random.index = 0;
+}
 
-        /* Set the Mersenne Twister initial state. */
-        context->random_mt.data[0] = seed & 0xffffffffUL;
-        int j;
-        for (j = 1; j < MT_PERIOD; j++) {
-                context->random_mt.data[j] = (1812433253UL *
-                        (context->random_mt.data[j - 1] ^
-                            (context->random_mt.data[j - 1] >> 30)) +
-                    j);
-                context->random_mt.data[j] &= 0xffffffffUL;
-        }
-        context->random_mt.index = MT_PERIOD;
+/* Select the PRNG stream, e.g. for a new Monte-Carlo event. */
+static void random_stream(
+    struct simulation_context * context, unsigned long stream)
+{
+        context->random.stream = stream;
+        context->random.index = 0;
+}
 
-        return;
-error:
-        danton_error_push(&context->api,
-            "%s (%d): could not Initialise PRNG from %s.", __FILE__, __LINE__,
-            urandom);
-        exit(EXIT_FAILURE);
+/* The Philox4x32-10 block function, from Salmon et al. (2011),
+ * doi:10.1145/2063384.2063405.
+ */
+static void random_philox(
+    const uint32_t * counter, const uint32_t * key, uint32_t * out)
+{
+        uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2],
+                 c3 = counter[3];
+        uint32_t k0 = key[0], k1 = key[1];
+        int round;
+        for (round = 0; round < 10; round++) {
+                const uint64_t p0 = (uint64_t)0xD2511F53U * c0;
+                const uint64_t p1 = (uint64_t)0xCD9E8D57U * c2;
+                c0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+                c1 = (uint32_t)p1;
+                c2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+                c3 = (uint32_t)p0;
+                k0 += 0x9E3779B9U;
+                k1 += 0xBB67AE85U;
+        }
+        out[0] = c0;
+        out[1] = c1;
+        out[2] = c2;
+        out[3] = c3;
 }
 
-/* Uniform pseudo random distribution over [0,1] from a Mersenne Twister. */
+/* Uniform pseudo random distribution over ]0,1[ from a Philox generator. The
+ * draw is fully determined by the seed, the stream and the draw index.
+ */
 static double random_uniform01(struct simulation_context * context)
 {
-        /* Check the buffer. */
-        if (context->random_mt.index < MT_PERIOD - 1) {
-                context->random_mt.index++;
-        } else {
-                /* Update the MT state. */
-                const int M = 397;
-                const unsigned long UPPER_MASK = 0x80000000UL;
-                const unsigned long LOWER_MASK = 0x7fffffffUL;
-                static unsigned long mag01[2] = { 0x0UL, 0x9908b0dfUL };
-                unsigned long y;
-                int kk;
-                for (kk = 0; kk < MT_PERIOD - M; kk++) {
-                        y = (context->random_mt.data[kk] & UPPER_MASK) |
-                            (context->random_mt.data[kk + 1] & LOWER_MASK);
-                        context->random_mt.data[kk] =
-                            context->random_mt.data[kk + M] ^ (y >> 1) ^
-                            mag01[y & 0x1UL];
-                }
-                for (; kk < MT_PERIOD - 1; kk++) {
-                        y = (context->random_mt.data[kk] & UPPER_MASK) |
-                            (context->random_mt.data[kk + 1] & LOWER_MASK);
-                        context->random_mt.data[kk] =
-                            context->random_mt.data[kk + (M - MT_PERIOD)] ^
-                            (y >> 1) ^ mag01[y & 0x1UL];
-                }
-                y = (context->random_mt.data[MT_PERIOD - 1] & UPPER_MASK) |
-                    (context->random_mt.data[0] & LOWER_MASK);
-                context->random_mt.data[MT_PERIOD - 1] =
-                    context->random_mt.data[M - 1] ^ (y >> 1) ^
-                    mag01[y & 0x1UL];
-                context->random_mt.index = 0;
-        }
-
-        /* Tempering. */
-        unsigned long y = context->random_mt.data[context->random_mt.index];
-        y ^= (y >> 11);
-        y ^= (y << 7) & 0x9d2c5680UL;
-        y ^= (y << 15) & 0xefc60000UL;
-        y ^= (y >> 18);
+        if (context->api.random != NULL)
+                return context->api.random(&context->api);
+
+        /* Generate a new block of 4 numbers if needed. */
+        const int i = context->random.index & 0x3;
+        if (i == 0) {
+                const unsigned long block = context->random.index >> 2;
+                const uint64_t stream = context->random.stream;
+                const uint64_t seed = context->random.seed;
+                const uint32_t counter[4] = { (uint32_t)stream,
+                        (uint32_t)(stream >> 32), (uint32_t)block,
+                        (uint32_t)((uint64_t)block >> 32) };
+                const uint32_t key[2] = { (uint32_t)seed,
+                        (uint32_t)(seed >> 32) };
+                random_philox(counter, key, context->random.buffer);
+        }
+        context->random.index++;
 
         /* Convert to a floating point and return. */
-        return y * (1.0 / 4294967295.0);
+        return (context->random.buffer[i] + 0.5) * (1.0 / 4294967296.0);
 }
 
 /* Encapsulation of the random engine for PUMAS. */
@@ -822,30 +1300,166 @@ static void record_copy_pumas(
 }
 
 /* Copy an ALOUETTE decay product to the event record. */
-static void record_copy_product(
+static int record_copy_product(
     struct simulation_context * context, int pid, double * momentum)
 {
-        /* Manage the memory. */
+        /* The arena has room for the products of a tau decay. */
         struct event_record * record = context->record;
-        if (record->api.n_products == record->buffer_size) {
-                const int n = 2 * record->buffer_size;
-                record = realloc(
-                    record, sizeof(*record) + n * sizeof(*record->product));
-                if (record == NULL) return;
-                context->record = record;
-                record->buffer_size = n;
+        if (record->api.n_products >= DECAY_PRODUCTS_MAX) {
+                danton_error_push(&context->api,
+                    "%s (%d): too many decay products (> %d).", __FILE__,
+                    __LINE__, DECAY_PRODUCTS_MAX);
+                return EXIT_FAILURE;
         }
 
         /* Append the decay product to the stack. */
-        struct danton_product * product =
-            record->product + record->api.n_products;
+        struct danton_product * product = context->arena.products +
+            context->arena.n_products + record->api.n_products;
         product->pid = pid;
         memcpy(product->momentum, momentum, sizeof(product->momentum));
         record->api.n_products++;
+        return EXIT_SUCCESS;
+}
+
+/* Atomic increment of a shared counter, returning its previous value. */
+static long counter_fetch_add(long * counter)
+{
+#ifdef __GNUC__
+        return __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+#else
+        if (lock != NULL) lock();
+        const long value = (*counter)++;
+        if (unlock != NULL) unlock();
+        return value;
+#endif
+}
+
+/* Atomic read of a shared counter. */
+static long counter_load(long * counter)
+{
+#ifdef __GNUC__
+        return __atomic_load_n(counter, __ATOMIC_RELAXED);
+#else
+        if (lock != NULL) lock();
+        const long value = *counter;
+        if (unlock != NULL) unlock();
+        return value;
+#endif
+}
+
+/* Get the number of published events for the current run, including the
+ * ones of any other context sharing the count.
+ */
+static long record_published(struct simulation_context * context)
+{
+        if (context->shared_published == NULL) return context->n_published;
+        return counter_load(context->shared_published);
+}
+
+/* Reserve memory for the current record of the arena. */
+static int arena_reserve(struct simulation_context * context)
+{
+        if (context->arena.n >= context->arena.size) {
+                const long size =
+                    (context->arena.size == 0) ? 16 : 2 * context->arena.size;
+                struct event_record * records = realloc(
+                    context->arena.records, size * sizeof(*records));
+                if (records == NULL) goto error;
+                memset(records + context->arena.size, 0x0,
+                    (size - context->arena.size) * sizeof(*records));
+                context->arena.records = records;
+                context->arena.size = size;
+        }
+        if (context->arena.n_products + DECAY_PRODUCTS_MAX >
+            context->arena.products_size) {
+                const long size = (context->arena.products_size == 0) ?
+                    16 * DECAY_PRODUCTS_MAX :
+                    2 * context->arena.products_size;
+                struct danton_product * products = realloc(
+                    context->arena.products, size * sizeof(*products));
+                if (products == NULL) goto error;
+                context->arena.products = products;
+                context->arena.products_size = size;
+        }
+
+        /* Update the pointers of the current record. */
+        struct event_record * record =
+            context->arena.records + context->arena.n;
+        record->api.primary = &record->primary;
+        record->api.final = &record->final;
+        if (record->api.vertex != NULL) record->api.vertex = &record->vertex;
+        context->record = record;
+
+        return EXIT_SUCCESS;
+
+error:
+        danton_error_push(&context->api, "%s (%d): could not allocate memory.",
+            __FILE__, __LINE__);
+        return EXIT_FAILURE;
+}
+
+/* Reset the arena, and create the current record if needed. */
+static int arena_reset(struct simulation_context * context)
+{
+        context->arena.batch = 0;
+        context->arena.n = 0;
+        context->arena.consumed = 0;
+        context->arena.consumed_products = 0;
+        context->arena.n_products = 0;
+        if (arena_reserve(context) != EXIT_SUCCESS) return EXIT_FAILURE;
+        context->record->api.n_products = 0;
+        return EXIT_SUCCESS;
+}
+
+/* Keep the current record in the arena and start a new one, initialised
+ * from the kept one.
+ */
+static int arena_commit(struct simulation_context * context)
+{
+        const long i = context->arena.n++;
+        context->arena.n_products += context->arena.records[i].api.n_products;
+        if (arena_reserve(context) != EXIT_SUCCESS) return EXIT_FAILURE;
+        struct event_record * record = context->record;
+        memcpy(record, context->arena.records + i, sizeof(*record));
+        record->api.n_products = 0;
+        return arena_reserve(context);
+}
+
+/* Expose the next consumed record of the arena. */
+static void arena_consume(
+    struct simulation_context * context, struct danton_event * event)
+{
+        struct event_record * record =
+            context->arena.records + context->arena.consumed++;
+        memcpy(event, &record->api, sizeof(*event));
+        event->primary = &record->primary;
+        event->vertex = (record->api.vertex != NULL) ? &record->vertex : NULL;
+        event->final = &record->final;
+        if (record->api.n_products > 0) {
+                event->product = context->arena.products +
+                    context->arena.consumed_products;
+                context->arena.consumed_products += record->api.n_products;
+        } else
+                event->product = NULL;
 }
 
-/* Counter for the number of published events. */
-static long n_published = 0;
+/* Discard the consumed records of the arena. */
+static int arena_compact(struct simulation_context * context)
+{
+        const long k = context->arena.consumed;
+        if (k == 0) return EXIT_SUCCESS;
+        const long m = context->arena.consumed_products;
+        memmove(context->arena.records, context->arena.records + k,
+            (context->arena.n - k + 1) * sizeof(*context->arena.records));
+        memmove(context->arena.products, context->arena.products + m,
+            (context->arena.n_products - m) *
+                sizeof(*context->arena.products));
+        context->arena.n -= k;
+        context->arena.n_products -= m;
+        context->arena.consumed = 0;
+        context->arena.consumed_products = 0;
+        return arena_reserve(context);
+}
 
 /* Publish the event record to the recorder. */
 static int record_publish(struct simulation_context * context)
@@ -854,24 +1468,210 @@ static int record_publish(struct simulation_context * context)
         struct event_record * record = context->record;
         if (context->api.decay && (record->api.n_products == 0))
                 return EXIT_SUCCESS;
+
+        /* During trial runs, only the weight sums are updated. */
+        if (context->tuning) {
+                context->n_published++;
+                context->weight_sum += record->api.weight;
+                context->weight_sum2 += record->api.weight * record->api.weight;
+                record->api.n_products = 0;
+                return EXIT_SUCCESS;
+        }
+
+        /* Reserve a slot in any shared count. Events beyond the requested
+         * total are discarded, which might happen when several contexts
+         * complete concurrently.
+         */
+        if ((context->shared_published != NULL) &&
+            (counter_fetch_add(context->shared_published) >=
+                context->requested)) {
+                record->api.n_products = 0;
+                return EXIT_SUCCESS;
+        }
+
+        /* Update the weight moments, including any shared tally. */
+        const double weight = record->api.weight;
+        context->stats.published++;
+        context->stats.weight_sum += weight;
+        context->stats.weight_sum2 += weight * weight;
+        context->weight_sum += weight;
+        context->weight_sum2 += weight * weight;
+        struct danton_tally * tally = context->api.tally;
+        if (tally != NULL) {
+                if (lock != NULL) lock();
+                tally->published++;
+                tally->weight_sum += weight;
+                tally->weight_sum2 += weight * weight;
+                if (unlock != NULL) unlock();
+        }
+
+        /* Keep the record in the arena when pulling events by batches.
+         * Otherwise, call the event processor.
+         */
+        if (context->arena.batch) {
+                context->n_published++;
+                return arena_commit(context);
+        }
         if (record->api.n_products > 0)
-                record->api.product = record->product;
+                record->api.product =
+                    context->arena.products + context->arena.n_products;
         else
                 record->api.product = NULL;
-
-        /* Call the event processor. */
+        STATS_START(timer);
         int rc = context->api.recorder->record_event(
             &context->api, context->api.recorder, &record->api);
+        STATS_STOP(context, DANTON_STAGE_RECORDER, timer);
 
         /* Reset the record for new data. */
         record->api.n_products = 0;
 
         /* Update the event count. */
-        n_published++;
+        context->n_published++;
 
         return rc;
 }
 
+/* Table of pre-sampled tau decays, in the tau rest frame. The tau
+ * polarisation is along the z-axis. The products of the i-th decay are
+ * indexed from offset[i] to offset[i + 1] - 1. Their four-momenta are stored
+ * as (E, px, py, pz).
+ */
+struct decay_table {
+        long n_decays;
+        long n_products;
+        long * offset;
+        int * pid;
+        double (*momentum)[4];
+};
+
+/* Library of pre-sampled tau decays, for tau (0) and tau bar (1). The
+ * requested size is the number of decays per table.
+ */
+static struct {
+        long size;
+        int enabled;
+        struct decay_table table[2];
+} decay_library = { 0, 0 };
+
+/* Sample a tau decay from the library, and boost it to the tau momentum. The
+ * tau polarisation is assumed to be along its momentum.
+ */
+static void decay_library_sample(
+    struct simulation_context * context, int pid, const double * momentum)
+{
+        const struct decay_table * table =
+            decay_library.table + ((pid > 0) ? 0 : 1);
+        long i = (long)(random_uniform01(context) * table->n_decays);
+        if (i >= table->n_decays) i = table->n_decays - 1;
+
+        /* Build a local frame with the z-axis along the tau momentum and a
+         * random orientation around it.
+         */
+        const double p2 = momentum[0] * momentum[0] +
+            momentum[1] * momentum[1] + momentum[2] * momentum[2];
+        const double p = sqrt(p2);
+        double uz[3] = { 0., 0., 1. };
+        if (p > 0.) {
+                uz[0] = momentum[0] / p;
+                uz[1] = momentum[1] / p;
+                uz[2] = momentum[2] / p;
+        }
+        double ux[3] = { 0., 0., 0. };
+        ux[(fabs(uz[0]) < 0.9) ? 0 : 1] = 1.;
+        const double d = ux[0] * uz[0] + ux[1] * uz[1] + ux[2] * uz[2];
+        ux[0] -= d * uz[0];
+        ux[1] -= d * uz[1];
+        ux[2] -= d * uz[2];
+        const double n = 1. / sqrt(ux[0] * ux[0] + ux[1] * ux[1] +
+                                  ux[2] * ux[2]);
+        ux[0] *= n;
+        ux[1] *= n;
+        ux[2] *= n;
+        const double uy[3] = { uz[1] * ux[2] - uz[2] * ux[1],
+                uz[2] * ux[0] - uz[0] * ux[2], uz[0] * ux[1] - uz[1] * ux[0] };
+        const double phi = 2. * M_PI * random_uniform01(context);
+        const double c = cos(phi);
+        const double s = sin(phi);
+
+        /* Rotate and boost the products. */
+        const double gamma = sqrt(p2 + tau_mass * tau_mass) / tau_mass;
+        const double bg = p / tau_mass;
+        long j;
+        int k = 0;
+        for (j = table->offset[i]; j < table->offset[i + 1]; j++, k++) {
+                const double * q = table->momentum[j];
+                const double qx = c * q[1] - s * q[2];
+                const double qy = s * q[1] + c * q[2];
+                const double qz = gamma * q[3] + bg * q[0];
+                double * pk = context->decay.momentum[k];
+                pk[0] = qx * ux[0] + qy * uy[0] + qz * uz[0];
+                pk[1] = qx * ux[1] + qy * uy[1] + qz * uz[1];
+                pk[2] = qx * ux[2] + qy * uy[2] + qz * uz[2];
+                context->decay.pid[k] = table->pid[j];
+        }
+        context->decay.n = k;
+        context->decay.index = 0;
+}
+
+/* Sample a tau decay, from the library or with ALOUETTE/TAUOLA. The decay
+ * products are buffered in the context. Thus, since ALOUETTE/TAUOLA has a
+ * global state, the lock is only held for the decay itself, not for the
+ * processing of its products.
+ */
+static int decay_sample(struct simulation_context * context, int pid,
+    const double * momentum, const double * polarisation)
+{
+        if (decay_library.enabled) {
+                decay_library_sample(context, pid, momentum);
+                return EXIT_SUCCESS;
+        }
+
+        if (lock != NULL) lock();
+        int trials;
+        for (trials = 0; trials < 20; trials++) {
+                if (alouette_decay(pid, momentum, polarisation) ==
+                    ALOUETTE_RETURN_SUCCESS)
+                        break;
+        }
+
+        /* Drain all the products, in order to leave ALOUETTE in a clean
+         * state, even if there are too many of them.
+         */
+        int n = 0, pid1;
+        double p[3];
+        while (alouette_product(&pid1, p) == ALOUETTE_RETURN_SUCCESS) {
+                if (n < DECAY_PRODUCTS_MAX) {
+                        context->decay.pid[n] = pid1;
+                        memcpy(context->decay.momentum[n], p, sizeof(p));
+                }
+                n++;
+        }
+        if (unlock != NULL) unlock();
+
+        context->decay.index = 0;
+        if (n > DECAY_PRODUCTS_MAX) {
+                context->decay.n = 0;
+                danton_error_push(&context->api,
+                    "%s (%d): too many decay products (%d > %d).", __FILE__,
+                    __LINE__, n, DECAY_PRODUCTS_MAX);
+                return EXIT_FAILURE;
+        }
+        context->decay.n = n;
+        return EXIT_SUCCESS;
+}
+
+/* Get the next product of the last tau decay. */
+static int decay_product(
+    struct simulation_context * context, int * pid, double * momentum)
+{
+        if (context->decay.index >= context->decay.n) return EXIT_FAILURE;
+        const int i = context->decay.index++;
+        *pid = context->decay.pid[i];
+        memcpy(momentum, context->decay.momentum[i],
+            sizeof(context->decay.momentum[i]));
+        return EXIT_SUCCESS;
+}
+
 /* Shortcut for dumping a PUMAS error. */
 #define ERROR_PUMAS(context, rc, function)                                     \
         danton_error_push(context, "%s (%d): error in %s, `%s`.", __FILE__,    \
@@ -906,8 +1706,10 @@ static int call_pumas(
         }
 
         /* Call PUMAS. */
-        if ((rc = pumas_transport(context_->pumas, &state->base.pumas)) !=
-            PUMAS_RETURN_SUCCESS) {
+        STATS_START(timer);
+        rc = pumas_transport(context_->pumas, &state->base.pumas);
+        STATS_STOP(context_, DANTON_STAGE_PUMAS, timer);
+        if (rc != PUMAS_RETURN_SUCCESS) {
                 ERROR_PUMAS(context, rc, pumas_transport);
                 return EXIT_FAILURE;
         }
@@ -967,8 +1769,36 @@ static enum ent_return stepping_ent(struct ent_context * context,
             __LINE__, ent_error_function((ent_function_t *)function),          \
             ent_error_string(rc))
 
-/* Forward transport routine, recursive. */
-static int transport_forward(struct simulation_context * context,
+/* Push a particle on the transport stack. */
+static int transport_push(struct simulation_context * context,
+    const struct generic_state * state, int generation)
+{
+        if (context->stack.n == context->stack.size) {
+                const int size =
+                    (context->stack.size == 0) ? 16 : 2 * context->stack.size;
+                struct transport_item * items = realloc(
+                    context->stack.items, size * sizeof(*items));
+                if (items == NULL) {
+                        danton_error_push(&context->api,
+                            "%s (%d): could not allocate memory.", __FILE__,
+                            __LINE__);
+                        return EXIT_FAILURE;
+                }
+                context->stack.items = items;
+                context->stack.size = size;
+        }
+        struct transport_item * item =
+            context->stack.items + context->stack.n++;
+        memcpy(&item->state, state, sizeof(item->state));
+        item->generation = generation;
+        return EXIT_SUCCESS;
+}
+
+/* Forward transport of a single neutrino. Secondary neutrinos from tau decays
+ * are pushed on the transport stack, followed by the current neutrino if its
+ * transport is not over.
+ */
+static int transport_neutrino(struct simulation_context * context,
     struct ent_state * neutrino, int generation)
 {
         if ((neutrino->pid != ENT_PID_NU_BAR_E) &&
@@ -991,8 +1821,11 @@ static int transport_forward(struct simulation_context * context,
         for (;;) {
                 /* Neutrino transport with ENT. */
                 enum ent_return rc;
-                if ((rc = ent_transport(physics, &context->ent, neutrino,
-                         &product, &event)) != ENT_RETURN_SUCCESS) {
+                STATS_START(timer);
+                rc = ent_transport(
+                    physics, &context->ent, neutrino, &product, &event);
+                STATS_STOP(context, DANTON_STAGE_ENT, timer);
+                if (rc != ENT_RETURN_SUCCESS) {
                         ERROR_ENT(&context->api, rc, ent_transport);
                         return EXIT_FAILURE;
                 }
@@ -1070,20 +1903,19 @@ static int transport_forward(struct simulation_context * context,
                                 double momentum[3] = { p * tau->direction[0],
                                         p * tau->direction[1],
                                         p * tau->direction[2] };
-                                int trials;
-                                for (trials = 0; trials < 20; trials++) {
-                                        if (alouette_decay(product.pid,
-                                                momentum, tau->direction) ==
-                                            ALOUETTE_RETURN_SUCCESS)
-                                                break;
-                                }
+                                STATS_START(timer);
+                                const int rc = decay_sample(context,
+                                    product.pid, momentum, tau->direction);
+                                STATS_STOP(
+                                    context, DANTON_STAGE_DECAY, timer);
+                                if (rc != EXIT_SUCCESS) return EXIT_FAILURE;
                                 int pid;
                                 struct generic_state nu_e_data, nu_t_data;
                                 memset(&nu_e_data, 0x0, sizeof(nu_e_data));
                                 memset(&nu_t_data, 0x0, sizeof(nu_t_data));
                                 struct ent_state *nu_e = NULL, *nu_t = NULL;
-                                while (alouette_product(&pid, momentum) ==
-                                    ALOUETTE_RETURN_SUCCESS) {
+                                while (decay_product(context, &pid, momentum) ==
+                                    EXIT_SUCCESS) {
                                         if (abs(pid) == 16) {
                                                 /* Update the neutrino state
                                                  * with the nu_tau daughter.
@@ -1112,8 +1944,9 @@ static int transport_forward(struct simulation_context * context,
                                                 record_copy_pumas(
                                                     context->record->api.final,
                                                     tau);
-                                        record_copy_product(
-                                            context, pid, momentum);
+                                        if (record_copy_product(context, pid,
+                                                momentum) != EXIT_SUCCESS)
+                                                return EXIT_FAILURE;
                                 }
                                 if (context->record->api.n_products > 0) {
                                         context->record->api.generation =
@@ -1124,46 +1957,56 @@ static int transport_forward(struct simulation_context * context,
                                 }
                                 generation++;
 
-                                /* Process any additional nu_e~ or nu_tau. */
+                                /* Process any additional nu_e~ or nu_tau
+                                 * before resuming the current neutrino.
+                                 */
                                 const double tau_altitude = compute_geodetic(
                                     tau_data.x, tau->position, NULL, NULL);
 
-                                if (nu_e != NULL) {
-                                        nu_e_data.context = context;
-                                        if (context->flux_neutrino) {
-                                                nu_e_data.is_inside = -1;
-                                                nu_e_data.has_crossed = 0;
-                                                nu_e_data.cross_count =
+                                if (((neutrino->pid == ENT_PID_NU_BAR_E) ||
+                                        (abs(neutrino->pid) ==
+                                            ENT_PID_NU_TAU)) &&
+                                    (transport_push(context,
+                                         (struct generic_state *)neutrino,
+                                         generation) != EXIT_SUCCESS))
+                                        return EXIT_FAILURE;
+                                if (nu_t != NULL) {
+                                        nu_t_data.context = context;
+                                        if (context->flux_neutrino) {
+                                                nu_t_data.is_inside = -1;
+                                                nu_t_data.has_crossed = 0;
+                                                nu_t_data.cross_count =
                                                     (tau_altitude <=
                                                         sampler->altitude[0] +
                                                             FLT_EPSILON) ?
                                                     1 :
                                                     0;
                                         } else {
-                                                nu_e_data.has_crossed = -1;
+                                                nu_t_data.has_crossed = -1;
                                         }
-                                        if (transport_forward(context, nu_e,
+                                        if (transport_push(context, &nu_t_data,
                                                 generation) != EXIT_SUCCESS)
                                                 return EXIT_FAILURE;
                                 }
-                                if (nu_t != NULL) {
-                                        nu_t_data.context = context;
+                                if (nu_e != NULL) {
+                                        nu_e_data.context = context;
                                         if (context->flux_neutrino) {
-                                                nu_t_data.is_inside = -1;
-                                                nu_t_data.has_crossed = 0;
-                                                nu_t_data.cross_count =
+                                                nu_e_data.is_inside = -1;
+                                                nu_e_data.has_crossed = 0;
+                                                nu_e_data.cross_count =
                                                     (tau_altitude <=
                                                         sampler->altitude[0] +
                                                             FLT_EPSILON) ?
                                                     1 :
                                                     0;
                                         } else {
-                                                nu_t_data.has_crossed = -1;
+                                                nu_e_data.has_crossed = -1;
                                         }
-                                        if (transport_forward(context, nu_t,
+                                        if (transport_push(context, &nu_e_data,
                                                 generation) != EXIT_SUCCESS)
                                                 return EXIT_FAILURE;
                                 }
+                                return EXIT_SUCCESS;
                         } else if (tau_data.has_crossed == 1) {
                                 record_copy_pumas(
                                     context->record->api.final, tau);
@@ -1180,6 +2023,31 @@ static int transport_forward(struct simulation_context * context,
         return EXIT_SUCCESS;
 }
 
+/* Forward transport routine. Secondary neutrinos are processed iteratively,
+ * depth first, from the transport stack of the context.
+ */
+static int transport_forward(struct simulation_context * context,
+    struct ent_state * neutrino, int generation)
+{
+        context->stack.n = 0;
+        if (transport_push(context, (struct generic_state *)neutrino,
+                generation) != EXIT_SUCCESS)
+                return EXIT_FAILURE;
+
+        while (context->stack.n > 0) {
+                /* Pop a copy of the item, since the stack might be
+                 * reallocated by the transport.
+                 */
+                struct transport_item item =
+                    context->stack.items[--context->stack.n];
+                if (transport_neutrino(context, &item.state.base.ent,
+                        item.generation) != EXIT_SUCCESS)
+                        return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+}
+
 /* Ancestor callback for taus. */
 static double ancestor_tau(
     struct ent_context * context, struct ent_state * state)
@@ -1222,7 +2090,8 @@ static double ancestor_cb(struct ent_context * context, enum ent_pid ancestor,
 /* Polarisation callback for ALOUETTE in backward mode. A 100% longitudinal
  * polarisation is assumed.
  */
-void polarisation_cb(int pid, const double momentum[3], double * polarisation)
+static void polarisation_cb(
+    int pid, const double momentum[3], double * polarisation)
 {
         double nrm = momentum[0] * momentum[0] + momentum[1] * momentum[1] +
             momentum[2] * momentum[2];
@@ -1238,10 +2107,14 @@ void polarisation_cb(int pid, const double momentum[3], double * polarisation)
         polarisation[2] = momentum[2] * nrm;
 }
 
-/* Backward transport routine. */
-static int transport_backward(
-    struct simulation_context * context, struct generic_state * current)
+/* Backward transport of a single decay generation. If a tau decay is
+ * backward sampled, the tau state is copied to *next* and *more* is set.
+ */
+static int transport_generation(struct simulation_context * context,
+    struct generic_state * current, struct generic_state * next, int * more)
 {
+        *more = 0;
+
         /* Backup the final state, e.g. the tau at decay. */
         if (context->record->api.generation == 1) {
                 if (current->is_tau)
@@ -1253,6 +2126,7 @@ static int transport_backward(
         }
 
         struct generic_state g_state;
+        memset(&g_state, 0x0, sizeof(g_state));
         struct ent_state * state = NULL;
         struct pumas_state * tau = NULL;
         double direction[3];
@@ -1268,8 +2142,8 @@ static int transport_backward(
 
                 /* Backward propagate the tau state. */
                 memcpy(direction, tau->direction, sizeof(direction));
-                const double lambda0 = 3E+07;
-                const double p1 = 0.1;
+                const double lambda0 = context->api.biasing.grammage;
+                const double p1 = context->api.biasing.recycle;
                 double x0;
                 for (;;) {
                         x0 = tau->grammage;
@@ -1395,8 +2269,11 @@ static int transport_backward(
         while ((event != ENT_EVENT_EXIT) &&
             (state->energy < context->energy_cut - FLT_EPSILON)) {
                 enum ent_return re;
-                if ((re = ent_transport(physics, &context->ent, state, NULL,
-                         &event)) != ENT_RETURN_SUCCESS) {
+                STATS_START(timer);
+                re = ent_transport(
+                    physics, &context->ent, state, NULL, &event);
+                STATS_STOP(context, DANTON_STAGE_ENT, timer);
+                if (re != ENT_RETURN_SUCCESS) {
                         ERROR_ENT(&context->api, re, ent_transport);
                         return EXIT_FAILURE;
                 }
@@ -1412,17 +2289,21 @@ static int transport_backward(
                                 state->energy * state->direction[1],
                                 state->energy * state->direction[2] };
                         double weight;
+                        if (lock != NULL) lock();
                         int trials;
                         for (trials = 0; trials < 20; trials++) {
                                 if (alouette_undecay(state->pid, momentum,
-                                        &polarisation_cb, DECAY_BIAS,
+                                        &polarisation_cb,
+                                        context->api.biasing.decay,
                                         &weight) == ALOUETTE_RETURN_SUCCESS)
                                         break;
                         }
 
                         int pid1;
-                        if ((alouette_product(&pid1, momentum) !=
-                                ALOUETTE_RETURN_SUCCESS) ||
+                        const enum alouette_return ra =
+                            alouette_product(&pid1, momentum);
+                        if (unlock != NULL) unlock();
+                        if ((ra != ALOUETTE_RETURN_SUCCESS) ||
                             (abs(pid1) != ENT_PID_TAU))
                                 return EXIT_SUCCESS;
                         const double p12 = momentum[0] * momentum[0] +
@@ -1462,7 +2343,9 @@ static int transport_backward(
                         g->has_crossed = -1;
                         g->cross_count = 0;
                         context->record->api.generation++;
-                        return transport_backward(context, g);
+                        if (g != next) memcpy(next, g, sizeof(*next));
+                        *more = 1;
+                        return EXIT_SUCCESS;
                 }
         }
         if (event != ENT_EVENT_EXIT) return EXIT_SUCCESS;
@@ -1495,74 +2378,577 @@ static int transport_backward(
         double momentum[3] = { p * context->record->final.direction[0],
                 p * context->record->final.direction[1],
                 p * context->record->final.direction[2] };
-        int trials;
-        for (trials = 0; trials < 20; trials++) {
-                if (alouette_decay(
-                        pid, momentum, context->record->final.direction) ==
-                    ALOUETTE_RETURN_SUCCESS)
-                        break;
-        }
+        STATS_START(timer);
+        const int rc = decay_sample(
+            context, pid, momentum, context->record->final.direction);
+        STATS_STOP(context, DANTON_STAGE_DECAY, timer);
+        if (rc != EXIT_SUCCESS) return EXIT_FAILURE;
 
         int pid1;
-        while (alouette_product(&pid1, momentum) == ALOUETTE_RETURN_SUCCESS) {
+        while (decay_product(context, &pid1, momentum) == EXIT_SUCCESS) {
                 if (abs(pid1 == 12) || (abs(pid1) == 13) || (abs(pid1) == 14) ||
                     (abs(pid1) == 16))
                         continue;
-                record_copy_product(context, pid1, momentum);
+                if (record_copy_product(context, pid1, momentum) !=
+                    EXIT_SUCCESS)
+                        return EXIT_FAILURE;
         }
         if (record_publish(context) != EXIT_SUCCESS) return EXIT_FAILURE;
         return EXIT_SUCCESS;
 }
 
-/* Loader for PUMAS. */
-static int load_pumas(struct danton_context * context)
+/* Backward transport routine. The decay generations are processed
+ * iteratively.
+ */
+static int transport_backward(
+    struct simulation_context * context, struct generic_state * current)
 {
-        const enum pumas_particle particle = PUMAS_PARTICLE_TAU;
-        const char * dump = ".danton.cfg";
-
-        /* First, attempt to load any binary dump. */
-        FILE * stream = fopen(dump, "rb");
-        if (stream != NULL) {
-                enum pumas_return rc;
-                if ((rc = pumas_load(stream)) != PUMAS_RETURN_SUCCESS) {
-                        fclose(stream);
-                        ERROR_PUMAS(context, rc, pumas_load);
+        struct generic_state next;
+        for (;;) {
+                int more;
+                if (transport_generation(context, current, &next, &more) !=
+                    EXIT_SUCCESS)
                         return EXIT_FAILURE;
+                if (!more) return EXIT_SUCCESS;
+                current = &next;
+        }
+}
+
+/* Version tag of the cached PUMAS tables. It must be incremented whenever
+ * the dump format of DANTON changes. The PUMAS version is hashed as well,
+ * from its header if available, and from the revision of its source, which
+ * is provided at build time.
+ */
+#define CACHE_VERSION "danton-pumas-1"
+
+/* Update a 64 bits FNV-1a hash with some data. */
+static uint64_t cache_hash(uint64_t hash, const void * data, size_t size)
+{
+        const unsigned char * p = data;
+        size_t i;
+        for (i = 0; i < size; i++) {
+                hash ^= p[i];
+                hash *= UINT64_C(0x100000001b3);
+        }
+        return hash;
+}
+
+/* Update a hash with the content of a file. */
+static int cache_hash_file(uint64_t * hash, const char * path)
+{
+        FILE * stream = fopen(path, "rb");
+        if (stream == NULL) return EXIT_FAILURE;
+        char buffer[4096];
+        size_t n;
+        while ((n = fread(buffer, 1, sizeof(buffer), stream)) > 0)
+                *hash = cache_hash(*hash, buffer, n);
+        fclose(stream);
+        return EXIT_SUCCESS;
+}
+
+/* Comparison of strings for qsort. */
+static int cache_compare(const void * a, const void * b)
+{
+        return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* Compute the cache key from the content of the MDF and of the energy loss
+ * tables.
+ */
+static int cache_key(const char * mdf, const char * dedx, uint64_t * key)
+{
+        uint64_t hash = UINT64_C(0xcbf29ce484222325);
+        hash = cache_hash(hash, CACHE_VERSION, sizeof(CACHE_VERSION));
+#ifdef PUMAS_VERSION_MAJOR
+        const int version[] = { PUMAS_VERSION_MAJOR, PUMAS_VERSION_MINOR,
+                PUMAS_VERSION_PATCH };
+        hash = cache_hash(hash, version, sizeof(version));
+#endif
+#ifdef DANTON_PUMAS_REVISION
+        hash = cache_hash(
+            hash, DANTON_PUMAS_REVISION, sizeof(DANTON_PUMAS_REVISION));
+#endif
+
+        /* The dump is a raw memory copy, thus it depends on the platform. */
+        const int sizes[] = { sizeof(void *), sizeof(long), sizeof(double) };
+        hash = cache_hash(hash, sizes, sizeof(sizes));
+        if (cache_hash_file(&hash, mdf) != EXIT_SUCCESS) return EXIT_FAILURE;
+
+        /* List the energy loss tables, sorted by name. */
+        DIR * dir = opendir(dedx);
+        if (dir == NULL) return EXIT_FAILURE;
+        char ** names = NULL;
+        int n = 0, size = 0, rc = EXIT_SUCCESS;
+        struct dirent * entry;
+        while ((entry = readdir(dir)) != NULL) {
+                if (entry->d_name[0] == '.') continue;
+                if (n == size) {
+                        size = (size == 0) ? 16 : 2 * size;
+                        char ** tmp = realloc(names, size * sizeof(*names));
+                        if (tmp == NULL) {
+                                rc = EXIT_FAILURE;
+                                break;
+                        }
+                        names = tmp;
                 }
-                fclose(stream);
-                pumas_particle(NULL, &tau_ctau0, &tau_mass);
-                goto exit;
+                if ((names[n] = malloc(strlen(entry->d_name) + 1)) == NULL) {
+                        rc = EXIT_FAILURE;
+                        break;
+                }
+                strcpy(names[n++], entry->d_name);
+        }
+        closedir(dir);
+        if (n > 0) qsort(names, n, sizeof(*names), &cache_compare);
+
+        /* Hash the tables names and content. */
+        int i;
+        for (i = 0; (i < n) && (rc == EXIT_SUCCESS); i++) {
+                hash = cache_hash(hash, names[i], strlen(names[i]) + 1);
+                const size_t m = strlen(dedx) + strlen(names[i]) + 2;
+                char * path = malloc(m);
+                if (path == NULL) {
+                        rc = EXIT_FAILURE;
+                        break;
+                }
+                snprintf(path, m, "%s/%s", dedx, names[i]);
+                rc = cache_hash_file(&hash, path);
+                free(path);
+        }
+
+        for (i = 0; i < n; i++) free(names[i]);
+        free(names);
+        *key = hash;
+        return rc;
+}
+
+/* Get the path to the cache directory, or `NULL` if caching is disabled.
+ * The returned string must be freed by the caller.
+ */
+static char * cache_directory(void)
+{
+        const char * root = cache_path;
+        const char * leaf = "";
+        if (root == NULL) root = getenv("DANTON_CACHE");
+        if (root == NULL) {
+                root = getenv("XDG_CACHE_HOME");
+                if ((root != NULL) && (*root != '\0'))
+                        leaf = "/danton";
+                else {
+                        root = getenv("HOME");
+                        leaf = "/.cache/danton";
+                }
+        }
+        if ((root == NULL) || (*root == '\0')) return NULL;
+
+        const size_t n = strlen(root) + strlen(leaf) + 1;
+        char * path = malloc(n);
+        if (path != NULL) snprintf(path, n, "%s%s", root, leaf);
+        return path;
+}
+
+/* Create a directory and its parents, if they do not exist. */
+static int cache_mkdir(char * path)
+{
+        char * p;
+        for (p = path + 1; *p != '\0'; p++) {
+                if (*p != '/') continue;
+                *p = '\0';
+                mkdir(path, 0755);
+                *p = '/';
+        }
+        if ((mkdir(path, 0755) != 0) && (errno != EEXIST))
+                return EXIT_FAILURE;
+        return EXIT_SUCCESS;
+}
+
+/* Write some data to the cache. The data are first dumped to a temporary
+ * file which is then renamed. Thus, concurrent jobs never read a partial
+ * dump.
+ */
+static void cache_dump(const char * path, int (*dump)(FILE * stream))
+{
+        const size_t n = strlen(path) + 8;
+        char * tmp = malloc(n);
+        if (tmp == NULL) return;
+        snprintf(tmp, n, "%s.XXXXXX", path);
+        const int fd = mkstemp(tmp);
+        if (fd < 0) {
+                free(tmp);
+                return;
+        }
+        fchmod(fd, 0644);
+
+        int success = 0;
+        FILE * stream = fdopen(fd, "wb");
+        if (stream == NULL)
+                close(fd);
+        else {
+                success = (dump(stream) == EXIT_SUCCESS);
+                if (fclose(stream) != 0) success = 0;
         }
+        if (!success || (rename(tmp, path) != 0)) remove(tmp);
+        free(tmp);
+}
+
+/* Dump the PUMAS tables to a stream. */
+static int cache_dump_pumas(FILE * stream)
+{
+        return (pumas_dump(stream) == PUMAS_RETURN_SUCCESS) ? EXIT_SUCCESS :
+                                                              EXIT_FAILURE;
+}
 
-        /* If no binary dump, initialise from the MDF and dump. */
+/* Initialise PUMAS, using any cached tables. */
+static int load_pumas(struct danton_context * context)
+{
+        const enum pumas_particle particle = PUMAS_PARTICLE_TAU;
         const char * mdf = (mdf_path == NULL) ?
             DANTON_DEFAULT_MDF : mdf_path;
         const char * dedx = (dedx_path == NULL) ?
             DANTON_DEFAULT_DEDX : dedx_path;
+        int rc = EXIT_SUCCESS;
+
+        /* Locate the cached tables, keyed by the physics inputs. */
+        char * directory = cache_directory();
+        char * cache = NULL;
+        uint64_t key;
+        if ((directory != NULL) &&
+            (cache_key(mdf, dedx, &key) == EXIT_SUCCESS)) {
+                const size_t n = strlen(directory) + 32;
+                cache = malloc(n);
+                if (cache != NULL) {
+                        snprintf(cache, n, "%s/pumas-%016" PRIx64 ".bin",
+                            directory, key);
+                }
+        }
 
-        pumas_initialise(particle, mdf, dedx, NULL);
-        pumas_particle(NULL, &tau_ctau0, &tau_mass);
+        /* First, attempt to load the cached tables. */
+        FILE * stream = (cache == NULL) ? NULL : fopen(cache, "rb");
+        if (stream != NULL) {
+                const enum pumas_return p_rc = pumas_load(stream);
+                fclose(stream);
+                if (p_rc == PUMAS_RETURN_SUCCESS) {
+                        pumas_particle(NULL, &tau_ctau0, &tau_mass);
+                        goto exit;
+                }
 
-        /* Dump the library configuration. */
-        stream = fopen(dump, "wb+");
-        if (stream == NULL) return EXIT_FAILURE;
-        pumas_dump(stream);
-        fclose(stream);
+                /* The cached tables are corrupted. Let us rebuild them. */
+                pumas_finalise();
+        }
+
+        /* Otherwise, initialise from the MDF and update the cache. */
+        enum pumas_return p_rc;
+        if ((p_rc = pumas_initialise(particle, mdf, dedx, NULL)) !=
+            PUMAS_RETURN_SUCCESS) {
+                ERROR_PUMAS(context, p_rc, pumas_initialise);
+                rc = EXIT_FAILURE;
+                goto exit;
+        }
+        pumas_particle(NULL, &tau_ctau0, &tau_mass);
+        if ((cache != NULL) && (cache_mkdir(directory) == EXIT_SUCCESS))
+                cache_dump(cache, &cache_dump_pumas);
 
 exit:
+        free(cache);
+        free(directory);
         free(mdf_path);
         mdf_path = NULL;
         free(dedx_path);
         dedx_path = NULL;
 
+        return rc;
+}
+
+/* Version of the decay library format. The cached library is also keyed by
+ * the ALOUETTE version and by the revision of its source, which is provided
+ * at build time, since they might change the sampled decays.
+ */
+#define DECAY_LIBRARY_VERSION 1
+
+/* Mass of tau decay products, in GeV / c^2, or a negative value if
+ * unknown.
+ */
+static double decay_mass(int pid)
+{
+        switch (abs(pid)) {
+        case 11:
+                return 0.51099895E-03;
+        case 12:
+        case 14:
+        case 16:
+        case 22:
+                return 0.;
+        case 13:
+                return 0.1056583755;
+        case 111:
+                return 0.1349768;
+        case 211:
+                return 0.13957039;
+        case 130:
+        case 310:
+        case 311:
+                return 0.497611;
+        case 321:
+                return 0.493677;
+        case 221:
+                return 0.547862;
+        case 223:
+                return 0.78266;
+        default:
+                return -1.;
+        }
+}
+
+/* Release the memory of the decay library. */
+static void decay_library_clear(void)
+{
+        int k;
+        for (k = 0; k < 2; k++) {
+                struct decay_table * table = decay_library.table + k;
+                free(table->offset);
+                free(table->pid);
+                free(table->momentum);
+                memset(table, 0x0, sizeof(*table));
+        }
+        decay_library.enabled = 0;
+}
+
+/* Allocate a decay table. */
+static int decay_table_allocate(
+    struct decay_table * table, long n_decays, long n_products)
+{
+        table->offset = malloc((n_decays + 1) * sizeof(*table->offset));
+        table->pid = malloc(n_products * sizeof(*table->pid));
+        table->momentum = malloc(n_products * sizeof(*table->momentum));
+        if ((table->offset == NULL) || (table->pid == NULL) ||
+            (table->momentum == NULL))
+                return EXIT_FAILURE;
+        table->n_decays = n_decays;
+        table->n_products = n_products;
+        return EXIT_SUCCESS;
+}
+
+/* Generate the decay library with ALOUETTE/TAUOLA. The decays are sampled
+ * for a tau with a momentum equal to its mass, along the z-axis, and then
+ * boosted back to the tau rest frame.
+ */
+static int decay_library_generate(struct danton_context * context)
+{
+        const long size = decay_library.size;
+        const double gamma = sqrt(2.);
+        const double bg = 1.;
+        const double momentum[3] = { 0., 0., tau_mass };
+        const double polarisation[3] = { 0., 0., 1. };
+
+        int k;
+        for (k = 0; k < 2; k++) {
+                struct decay_table * table = decay_library.table + k;
+                if (decay_table_allocate(
+                        table, size, size * DECAY_PRODUCTS_MAX) !=
+                    EXIT_SUCCESS) {
+                        danton_error_push(context,
+                            "%s (%d): could not allocate memory.", __FILE__,
+                            __LINE__);
+                        return EXIT_FAILURE;
+                }
+
+                const int pid = (k == 0) ? ENT_PID_TAU : ENT_PID_TAU_BAR;
+                long i, n = 0;
+                for (i = 0; i < size; i++) {
+                        table->offset[i] = n;
+                        int trials;
+                        for (trials = 0; trials < 20; trials++) {
+                                if (alouette_decay(pid, momentum,
+                                        polarisation) ==
+                                    ALOUETTE_RETURN_SUCCESS)
+                                        break;
+                        }
+
+                        int pid1;
+                        double p[3];
+                        while (alouette_product(&pid1, p) ==
+                            ALOUETTE_RETURN_SUCCESS) {
+                                const double m = decay_mass(pid1);
+                                if (m < 0.) {
+                                        danton_error_push(context,
+                                            "%s (%d): unsupported decay "
+                                            "product (%d).",
+                                            __FILE__, __LINE__, pid1);
+                                        return EXIT_FAILURE;
+                                }
+                                if (n - table->offset[i] >=
+                                    DECAY_PRODUCTS_MAX) {
+                                        danton_error_push(context,
+                                            "%s (%d): too many decay "
+                                            "products.",
+                                            __FILE__, __LINE__);
+                                        return EXIT_FAILURE;
+                                }
+                                const double e = sqrt(p[0] * p[0] +
+                                    p[1] * p[1] + p[2] * p[2] + m * m);
+                                table->pid[n] = pid1;
+                                table->momentum[n][0] = gamma * e - bg * p[2];
+                                table->momentum[n][1] = p[0];
+                                table->momentum[n][2] = p[1];
+                                table->momentum[n][3] = gamma * p[2] - bg * e;
+                                n++;
+                        }
+                }
+                table->offset[size] = n;
+                table->n_products = n;
+
+                /* Release the unused memory. */
+                if (n > 0) {
+                        int * pid_ = realloc(table->pid, n * sizeof(*pid_));
+                        if (pid_ != NULL) table->pid = pid_;
+                        double(*momentum_)[4] = realloc(
+                            table->momentum, n * sizeof(*momentum_));
+                        if (momentum_ != NULL) table->momentum = momentum_;
+                }
+        }
+
+        return EXIT_SUCCESS;
+}
+
+/* Dump the decay library to a stream. */
+static int decay_library_dump(FILE * stream)
+{
+        const char magic[8] = { 'D', 'A', 'N', 'T', 'O', 'N', 'D', 'L' };
+        const int version = DECAY_LIBRARY_VERSION;
+        if ((fwrite(magic, sizeof(magic), 1, stream) != 1) ||
+            (fwrite(&version, sizeof(version), 1, stream) != 1) ||
+            (fwrite(&tau_mass, sizeof(tau_mass), 1, stream) != 1))
+                return EXIT_FAILURE;
+
+        int k;
+        for (k = 0; k < 2; k++) {
+                const struct decay_table * t = decay_library.table + k;
+                if ((fwrite(&t->n_decays, sizeof(long), 1, stream) != 1) ||
+                    (fwrite(&t->n_products, sizeof(long), 1, stream) != 1) ||
+                    (fwrite(t->offset, sizeof(*t->offset), t->n_decays + 1,
+                         stream) != t->n_decays + 1) ||
+                    (fwrite(t->pid, sizeof(*t->pid), t->n_products, stream) !=
+                        t->n_products) ||
+                    (fwrite(t->momentum, sizeof(*t->momentum), t->n_products,
+                         stream) != t->n_products))
+                        return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+}
+
+/* Load the decay library from a stream. */
+static int decay_library_load(FILE * stream)
+{
+        char magic[8];
+        int version;
+        double mass;
+        if ((fread(magic, sizeof(magic), 1, stream) != 1) ||
+            (strncmp(magic, "DANTONDL", sizeof(magic)) != 0) ||
+            (fread(&version, sizeof(version), 1, stream) != 1) ||
+            (version != DECAY_LIBRARY_VERSION) ||
+            (fread(&mass, sizeof(mass), 1, stream) != 1) ||
+            (mass != tau_mass))
+                return EXIT_FAILURE;
+
+        int k;
+        for (k = 0; k < 2; k++) {
+                struct decay_table * t = decay_library.table + k;
+                long n_decays, n_products;
+                if ((fread(&n_decays, sizeof(n_decays), 1, stream) != 1) ||
+                    (n_decays != decay_library.size) ||
+                    (fread(&n_products, sizeof(n_products), 1, stream) != 1) ||
+                    (n_products < 0) ||
+                    (n_products > n_decays * DECAY_PRODUCTS_MAX) ||
+                    (decay_table_allocate(t, n_decays, n_products) !=
+                        EXIT_SUCCESS) ||
+                    (fread(t->offset, sizeof(*t->offset), n_decays + 1,
+                         stream) != n_decays + 1) ||
+                    (fread(t->pid, sizeof(*t->pid), n_products, stream) !=
+                        n_products) ||
+                    (fread(t->momentum, sizeof(*t->momentum), n_products,
+                         stream) != n_products))
+                        return EXIT_FAILURE;
+
+                /* Check the consistency of the offsets. */
+                long i;
+                if ((t->offset[0] != 0) || (t->offset[n_decays] != n_products))
+                        return EXIT_FAILURE;
+                for (i = 0; i < n_decays; i++) {
+                        const long d = t->offset[i + 1] - t->offset[i];
+                        if ((d < 0) || (d > DECAY_PRODUCTS_MAX))
+                                return EXIT_FAILURE;
+                }
+        }
         return EXIT_SUCCESS;
 }
 
+/* Initialise the decay library, using any cached one. */
+static int decay_library_initialise(struct danton_context * context)
+{
+        decay_library_clear();
+        if (decay_library.size <= 0) return EXIT_SUCCESS;
+
+        /* Compute the key of the cached library. */
+        const int version = DECAY_LIBRARY_VERSION;
+        uint64_t key = UINT64_C(0xcbf29ce484222325);
+        key = cache_hash(key, &version, sizeof(version));
+#ifdef ALOUETTE_VERSION_MAJOR
+        const int alouette_version[] = { ALOUETTE_VERSION_MAJOR,
+                ALOUETTE_VERSION_MINOR, ALOUETTE_VERSION_PATCH };
+        key = cache_hash(key, alouette_version, sizeof(alouette_version));
+#endif
+#ifdef DANTON_ALOUETTE_REVISION
+        key = cache_hash(
+            key, DANTON_ALOUETTE_REVISION, sizeof(DANTON_ALOUETTE_REVISION));
+#endif
+        key = cache_hash(
+            key, &decay_library.size, sizeof(decay_library.size));
+
+        /* Locate the cached library. */
+        char * directory = cache_directory();
+        char * cache = NULL;
+        if (directory != NULL) {
+                const size_t n = strlen(directory) + 32;
+                cache = malloc(n);
+                if (cache != NULL) {
+                        snprintf(cache, n, "%s/decays-%016" PRIx64 ".bin",
+                            directory, key);
+                }
+        }
+
+        /* First, attempt to load the cached library. */
+        int rc = EXIT_FAILURE;
+        FILE * stream = (cache == NULL) ? NULL : fopen(cache, "rb");
+        if (stream != NULL) {
+                rc = decay_library_load(stream);
+                fclose(stream);
+                if (rc != EXIT_SUCCESS) decay_library_clear();
+        }
+
+        /* Otherwise, generate the library and update the cache. */
+        if (rc != EXIT_SUCCESS) {
+                rc = decay_library_generate(context);
+                if (rc != EXIT_SUCCESS)
+                        decay_library_clear();
+                else if ((cache != NULL) &&
+                    (cache_mkdir(directory) == EXIT_SUCCESS))
+                        cache_dump(cache, &decay_library_dump);
+        }
+
+        free(cache);
+        free(directory);
+        if (rc == EXIT_SUCCESS) decay_library.enabled = 1;
+        return rc;
+}
+
 /* Low level routine for initialising the Physics engines. */
 static int initialise_physics(struct danton_context * context)
 {
         if (lock != NULL) lock();
-        if (physics != NULL) return EXIT_SUCCESS;
+        if (physics != NULL) {
+                /* The Physics has been initialised by another thread. */
+                if (unlock != NULL) unlock();
+                return EXIT_SUCCESS;
+        }
 
         /* Create a new neutrino Physics environment. */
         enum ent_return e_rc;
@@ -1592,6 +2978,12 @@ static int initialise_physics(struct danton_context * context)
                 return EXIT_FAILURE;
         }
 
+        /* Initialise any library of pre-sampled decays. */
+        if (decay_library_initialise(context) != EXIT_SUCCESS) {
+                if (unlock != NULL) unlock();
+                return EXIT_FAILURE;
+        }
+
         free(pdf_path);
         pdf_path = NULL;
         if (unlock != NULL) unlock();
@@ -1654,6 +3046,31 @@ int danton_initialise(const char * pdf, const char * mdf, const char * dedx,
         return EXIT_SUCCESS;
 }
 
+/* Set the cache directory for the physics tables. */
+int danton_cache_directory(const char * path)
+{
+        if (path == NULL) {
+                free(cache_path);
+                cache_path = NULL;
+                return EXIT_SUCCESS;
+        }
+        return copy_config_string(path, &cache_path);
+}
+
+/* Set the size of the library of pre-sampled tau decays. */
+int danton_decay_library(long size)
+{
+        if (physics != NULL) {
+                danton_error_push(NULL,
+                    "%s (%d): the decay library must be set before the first "
+                    "run.",
+                    __FILE__, __LINE__);
+                return EXIT_FAILURE;
+        }
+        decay_library.size = (size > 0) ? size : 0;
+        return EXIT_SUCCESS;
+}
+
 /* Finalise the DANTON library. */
 void danton_finalise(void)
 {
@@ -1663,6 +3080,9 @@ void danton_finalise(void)
         mdf_path = NULL;
         free(dedx_path);
         dedx_path = NULL;
+        free(cache_path);
+        cache_path = NULL;
+        decay_library_clear();
         ent_physics_destroy(&physics);
         pumas_finalise();
         alouette_finalise();
@@ -1775,23 +3195,115 @@ int danton_earth_model(const char * geodesic, const char * topography,
 
         /* Configure according to the current settings. */
         earth_model_configure();
+        earth.version++;
 
         return EXIT_SUCCESS;
 }
 
-/* Low level data structure for an event sampler. */
-struct event_sampler {
-        struct danton_sampler api;
-        char endstr;
-        double neutrino_weight;
-        double total_weight;
-        unsigned long hash;
+/* Set the grid of the topography data, for caching elevation values. */
+int danton_topography_grid(double spacing)
+{
+        if (spacing < 0.) {
+                danton_error_push(NULL,
+                    "%s (%d): invalid topography grid spacing (%g).",
+                    __FILE__, __LINE__, spacing);
+                return EXIT_FAILURE;
+        }
+        earth.grid = spacing / 3600.;
+        earth.version++;
+        return EXIT_SUCCESS;
+}
+
+/* Walker alias table for sampling an index from discrete weights. */
+struct alias_table {
+        /* The number of entries with a non null weight. */
+        int n;
+        /* The total weight. */
+        double total;
+        /* The index of each entry and its probability. */
+        int index[DANTON_PARTICLE_N];
+        double probability[DANTON_PARTICLE_N];
+        /* The cut value and the alias of each entry. */
+        double cut[DANTON_PARTICLE_N];
+        int alias[DANTON_PARTICLE_N];
 };
 
-/* Create a new event sampler. */
-struct danton_sampler * danton_sampler_create(void)
+/* Build an alias table, excluding null weights. */
+static void alias_table_build(
+    struct alias_table * table, int n, const double * weight)
 {
-        struct event_sampler * sampler;
+        table->n = 0;
+        table->total = 0.;
+        int i;
+        for (i = 0; i < n; i++) {
+                if (!(weight[i] > 0.)) continue;
+                table->index[table->n] = i;
+                table->total += weight[i];
+                table->n++;
+        }
+        if (table->n == 0) return;
+
+        /* Split the entries in under and over populated ones, w.r.t. the
+         * mean weight.
+         */
+        int small[DANTON_PARTICLE_N], large[DANTON_PARTICLE_N];
+        int n_small = 0, n_large = 0;
+        for (i = 0; i < table->n; i++) {
+                const double w = weight[table->index[i]];
+                table->probability[i] = w / table->total;
+                table->cut[i] = table->n * table->probability[i];
+                table->alias[i] = i;
+                if (table->cut[i] < 1.)
+                        small[n_small++] = i;
+                else
+                        large[n_large++] = i;
+        }
+
+        /* Fill the under populated entries with aliases. */
+        while ((n_small > 0) && (n_large > 0)) {
+                const int s = small[--n_small];
+                const int l = large[--n_large];
+                table->alias[s] = l;
+                table->cut[l] -= 1. - table->cut[s];
+                if (table->cut[l] < 1.)
+                        small[n_small++] = l;
+                else
+                        large[n_large++] = l;
+        }
+        while (n_large > 0) table->cut[large[--n_large]] = 1.;
+        while (n_small > 0) table->cut[small[--n_small]] = 1.;
+}
+
+/* Sample an index from an alias table. */
+static int alias_table_sample(struct simulation_context * context,
+    const struct alias_table * table, double * probability)
+{
+        int k = 0;
+        if (table->n > 1) {
+                const double x = table->n * random_uniform01(context);
+                k = (int)x;
+                if (k >= table->n) k = table->n - 1;
+                if (x - k >= table->cut[k]) k = table->alias[k];
+        }
+        if (probability != NULL) *probability = table->probability[k];
+        return table->index[k];
+}
+
+/* Low level data structure for an event sampler. */
+struct event_sampler {
+        struct danton_sampler api;
+        char endstr;
+        double neutrino_weight;
+        double total_weight;
+        struct alias_table taus;
+        unsigned long hash;
+        struct sampler_frame frame;
+};
+
+/* Create a new event sampler. */
+struct danton_sampler * danton_sampler_create(void)
+{
+        struct event_sampler * sampler;
         sampler = malloc(sizeof(*sampler));
         if (sampler == NULL) {
                 danton_error_push(NULL, "%s (%d): could not allocate memory.",
@@ -1884,6 +3396,20 @@ int danton_sampler_update(struct danton_sampler * sampler)
         if (sampler->weight[DANTON_PARTICLE_TAU] > 0.)
                 sampler_->total_weight += sampler->weight[DANTON_PARTICLE_TAU];
 
+        /* Build the alias table of final taus, for backward Monte-Carlo
+         * runs.
+         */
+        double tau_weight[DANTON_PARTICLE_N];
+        memset(tau_weight, 0x0, sizeof(tau_weight));
+        tau_weight[DANTON_PARTICLE_TAU_BAR] =
+            sampler->weight[DANTON_PARTICLE_TAU_BAR];
+        tau_weight[DANTON_PARTICLE_TAU] = sampler->weight[DANTON_PARTICLE_TAU];
+        alias_table_build(&sampler_->taus, DANTON_PARTICLE_N, tau_weight);
+
+        /* Precompute the local frame at the sampler location. */
+        sampler_frame_compute(
+            sampler->latitude, sampler->longitude, &sampler_->frame);
+
         /* Update the hash and return. */
         sampler_->hash = hash((unsigned char *)sampler);
         return EXIT_SUCCESS;
@@ -1901,7 +3427,16 @@ struct danton_context * danton_context_create(void)
         }
 
         /* Initialise the random engine. */
-        random_initialise(context);
+        context->api.random = NULL;
+        unsigned long seed;
+        if (random_get_seed(&seed) != EXIT_SUCCESS) {
+                danton_error_push(NULL,
+                    "%s (%d): could not initialise PRNG from %s.", __FILE__,
+                    __LINE__, urandom);
+                free(context);
+                return NULL;
+        }
+        random_seed(context, seed);
 
         /* Initialise the Monte-Carlo contexts and the recorder.
          */
@@ -1913,7 +3448,13 @@ struct danton_context * danton_context_create(void)
 
         context->pumas = NULL;
         context->client = NULL;
+        context->elevation.version = earth.version - 1;
         context->record = NULL;
+        memset(&context->arena, 0x0, sizeof(context->arena));
+        context->run = NULL;
+        context->stack.n = 0;
+        context->stack.size = 0;
+        context->stack.items = NULL;
         context->error.count = 0;
         context->error.size = 0;
         context->error.data[0] = 0;
@@ -1923,11 +3464,20 @@ struct danton_context * danton_context_create(void)
         context->api.mode = DANTON_MODE_BACKWARD;
         context->api.longitudinal = 0;
         context->api.decay = 1;
+        context->api.biasing.decay = 6.;
+        context->api.biasing.grammage = 3E+07;
+        context->api.biasing.recycle = 0.1;
+        context->api.sequence = DANTON_SEQUENCE_RANDOM;
         int i;
         for (i = 0; i < DANTON_PARTICLE_N_NU; i++)
                 context->api.primary[i] = NULL;
         context->api.sampler = NULL;
         context->api.recorder = NULL;
+        context->api.published = NULL;
+        context->api.event_offset = 0;
+        context->api.precision = 0.;
+        context->api.time_limit = 0.;
+        context->api.tally = NULL;
 
         /* The lower (upper) energy bound under (above) which
          * all
@@ -1938,6 +3488,12 @@ struct danton_context * danton_context_create(void)
 
         /* Flag to check if the neutrino flux is requested. */
         context->flux_neutrino = 0;
+        context->n_published = 0;
+        context->requested = 0;
+        context->shared_published = NULL;
+        context->tuning = 0;
+        context->sequence.type = DANTON_SEQUENCE_RANDOM;
+        memset(&context->stats, 0x0, sizeof(context->stats));
 
         return &context->api;
 }
@@ -1953,11 +3509,52 @@ void danton_context_destroy(struct danton_context ** context)
                 pumas_context_destroy(&context_->pumas);
         }
         turtle_client_destroy(&context_->client);
-        free(context_->record);
+        free(context_->arena.records);
+        free(context_->arena.products);
+        free(context_->run);
+        free(context_->stack.items);
         free(context_);
         *context = NULL;
 }
 
+/* Seed the random engine of a simulation context. */
+int danton_context_seed(
+    struct danton_context * context, const unsigned long * seed)
+{
+        unsigned long value;
+        if (seed != NULL)
+                value = *seed;
+        else if (random_get_seed(&value) != EXIT_SUCCESS) {
+                danton_error_push(context,
+                    "%s (%d): could not initialise PRNG from %s.", __FILE__,
+                    __LINE__, urandom);
+                return EXIT_FAILURE;
+        }
+        random_seed((struct simulation_context *)context, value);
+        return EXIT_SUCCESS;
+}
+
+/* Get the state of the random engine of a simulation context. */
+void danton_context_random_state(struct danton_context * context,
+    unsigned long * seed, long * stream, long * index)
+{
+        struct simulation_context * context_ =
+            (struct simulation_context *)context;
+        if (seed != NULL) *seed = context_->random.seed;
+        if (stream != NULL) *stream = (long)context_->random.stream;
+        if (index != NULL) *index = (long)context_->random.index;
+}
+
+/* Get the run statistics of a simulation context. */
+void danton_context_stats(
+    struct danton_context * context, struct danton_stats * stats, int reset)
+{
+        struct simulation_context * context_ =
+            (struct simulation_context *)context;
+        if (stats != NULL) memcpy(stats, &context_->stats, sizeof(*stats));
+        if (reset) memset(&context_->stats, 0x0, sizeof(context_->stats));
+}
+
 /* Get the PDG number corresponding to the given table index. */
 int danton_particle_pdg(enum danton_particle index)
 {
@@ -1993,9 +3590,109 @@ enum danton_particle danton_particle_index(int pdg)
         return DANTON_PARTICLE_UNKNOWN;
 }
 
+/* Configure the sequence for the generation of events. The Sobol direction
+ * numbers are computed from the primitive polynomials and the initial
+ * numbers of S. Joe and F. Y. Kuo. The scrambling is drawn from a dedicated
+ * random stream.
+ */
+static void sequence_configure(struct simulation_context * context,
+    enum danton_sequence type, long events)
+{
+        context->sequence.type = type;
+        context->sequence.events = events;
+        if (type == DANTON_SEQUENCE_RANDOM) return;
+
+        int d, b;
+        for (d = 0; d < SEQUENCE_N; d++) {
+                random_stream(context, (unsigned long)LONG_MAX + 1 + d);
+                context->sequence.scramble[d] =
+                    (uint32_t)(4294967296. * random_uniform01(context));
+        }
+
+        if (type != DANTON_SEQUENCE_SOBOL) return;
+        const int s[SEQUENCE_N] = { 0, 1, 2, 3 };
+        const unsigned int a[SEQUENCE_N] = { 0, 0, 1, 1 };
+        const uint32_t m[SEQUENCE_N][3] = { { 0 }, { 1 }, { 1, 3 },
+                { 1, 3, 1 } };
+        uint32_t(*v)[32] = context->sequence.direction;
+        for (b = 0; b < 32; b++) v[0][b] = (uint32_t)1 << (31 - b);
+        for (d = 1; d < SEQUENCE_N; d++) {
+                for (b = 0; b < s[d]; b++) v[d][b] = m[d][b] << (31 - b);
+                for (b = s[d]; b < 32; b++) {
+                        uint32_t vb = v[d][b - s[d]];
+                        vb ^= vb >> s[d];
+                        int k;
+                        for (k = 1; k < s[d]; k++) {
+                                if ((a[d] >> (s[d] - 1 - k)) & 1)
+                                        vb ^= v[d][b - k];
+                        }
+                        v[d][b] = vb;
+                }
+        }
+}
+
+/* Pseudo random permutation of [0, n[, using the hash of A. Kensler,
+ * "Correlated Multi-Jittered Sampling", Pixar Technical Memo 13-01 (2013).
+ */
+static uint32_t sequence_permute(uint32_t i, uint32_t n, uint32_t p)
+{
+        uint32_t w = n - 1;
+        w |= w >> 1;
+        w |= w >> 2;
+        w |= w >> 4;
+        w |= w >> 8;
+        w |= w >> 16;
+        do {
+                i ^= p;
+                i *= 0xe170893d;
+                i ^= p >> 16;
+                i ^= (i & w) >> 4;
+                i ^= p >> 8;
+                i *= 0x0929eb3f;
+                i ^= p >> 23;
+                i ^= (i & w) >> 1;
+                i *= 1 | p >> 27;
+                i *= 0x6935fa69;
+                i ^= (i & w) >> 11;
+                i *= 0x74dcb303;
+                i ^= (i & w) >> 2;
+                i *= 0x9e501cc3;
+                i ^= (i & w) >> 2;
+                i *= 0xc860a3df;
+                i &= w;
+                i ^= i >> 5;
+        } while (i >= n);
+        return (i + p) % n;
+}
+
+/* Get a uniform number in ]0, 1[ for a dimension of the generation of the
+ * i-th event, from the configured sequence.
+ */
+static double sample_uniform(
+    struct simulation_context * context, int dimension, long i)
+{
+        if (context->sequence.type == DANTON_SEQUENCE_SOBOL) {
+                /* Scrambled Sobol point, indexed by the event index. */
+                const uint32_t * v = context->sequence.direction[dimension];
+                uint64_t k = context->api.event_offset + i;
+                uint32_t x = context->sequence.scramble[dimension];
+                int b;
+                for (b = 0; (b < 32) && k; b++, k >>= 1)
+                        if (k & 1) x ^= v[b];
+                return (x + 0.5) / 4294967296.;
+        } else if (context->sequence.type == DANTON_SEQUENCE_LATIN_HYPERCUBE) {
+                /* Jittered point in a permuted stratum. */
+                const uint32_t n = context->sequence.events;
+                const uint32_t k = sequence_permute(
+                    i, n, context->sequence.scramble[dimension]);
+                return (k + random_uniform01(context)) / n;
+        } else
+                return random_uniform01(context);
+}
+
 /* Sample a parameter uniformly over a range. */
 static double sample_linear(struct simulation_context * context,
-    const double x[2], long i, long n, double * weight)
+    const double x[2], long i, long n, int dimension, double * weight)
 {
         double xi;
         if (x[0] < x[1]) {
@@ -2004,7 +3701,7 @@ static double sample_linear(struct simulation_context * context,
                 if ((context->api.mode == DANTON_MODE_GRAMMAGE) && (n > 0))
                         u = (n > 1) ? i / (n - 1.) : 0.;
                 else {
-                        u = random_uniform01(context);
+                        u = sample_uniform(context, dimension, i);
                         if (weight != NULL) *weight *= dx;
                 }
                 xi = dx * u + x[0];
@@ -2014,18 +3711,19 @@ static double sample_linear(struct simulation_context * context,
 }
 
 /* Sample a parameter log-uniformly over a range. */
-static double sample_log_or_linear(
-    struct simulation_context * context, double x[2], double * weight)
+static double sample_log_or_linear(struct simulation_context * context,
+    double x[2], long i, int dimension, double * weight)
 {
         double xi;
         if (x[0] < x[1]) {
+                const double u = sample_uniform(context, dimension, i);
                 if ((x[0] > 0.) || (x[1] < 0.)) {
                         const double r = log(x[1] / x[0]);
-                        xi = x[0] * exp(r * random_uniform01(context));
+                        xi = x[0] * exp(r * u);
                         if (weight != NULL) *weight *= fabs(r) * xi;
                 } else {
                         const double dx = x[1] - x[0];
-                        xi = x[0] + dx * random_uniform01(context);
+                        xi = x[0] + dx * u;
                         if (weight != NULL) *weight *= dx;
                 }
         } else
@@ -2033,12 +3731,29 @@ static double sample_log_or_linear(
         return xi;
 }
 
-/* Run a DANTON simulation. */
-int danton_run(struct danton_context * context, long events, long requested)
+/* State of a simulation run. */
+struct run_state {
+        /* The local frame at the sampler location. */
+        struct sampler_frame frame;
+        /* The generation cosines. */
+        double cos_theta[2];
+        /* The alias table for sampling the primary flavour. */
+        struct alias_table primaries;
+        /* The number of Monte-Carlo events or scan points, and the index of
+         * the next one.
+         */
+        long events;
+        long index;
+        /* The start time of the run. */
+        struct timespec start;
+};
+
+/* Check and configure a simulation context for a new run. */
+static int run_configure(
+    struct simulation_context * context_, long events, long requested)
 {
         /* Unpack the various objects. */
-        struct simulation_context * context_ =
-            (struct simulation_context *)context;
+        struct danton_context * context = &context_->api;
         struct danton_sampler * sampler = context->sampler;
         struct event_sampler * sampler_ = (struct event_sampler *)sampler;
 
@@ -2057,11 +3772,6 @@ int danton_run(struct danton_context * context, long events, long requested)
                 return EXIT_FAILURE;
         }
 
-        if (context->recorder == NULL) {
-                danton_error_push(context, "%s (%d): no recorder was provided.",
-                    __FILE__, __LINE__);
-                return EXIT_FAILURE;
-        }
         if ((context->mode < 0) || (context->mode >= DANTON_MODE_N)) {
                 danton_error_push(context, "%s (%d): invalid run mode (%d).",
                     __FILE__, __LINE__, context->mode);
@@ -2084,9 +3794,16 @@ int danton_run(struct danton_context * context, long events, long requested)
                             __LINE__);
                         return EXIT_FAILURE;
                 }
-                if (context->mode == DANTON_MODE_FORWARD)
-                        context_->flux_neutrino =
-                            sampler_->neutrino_weight > 0.;
+                context_->flux_neutrino =
+                    (context->mode == DANTON_MODE_FORWARD) &&
+                    (sampler_->neutrino_weight > 0.);
+                if ((context->mode == DANTON_MODE_BACKWARD) &&
+                    (sampler_->taus.n == 0)) {
+                        danton_error_push(context,
+                            "%s (%d): no tau(s) to sample in backward mode.",
+                            __FILE__, __LINE__);
+                        return EXIT_FAILURE;
+                }
 
                 if (context->decay) {
                         if (sampler_->neutrino_weight ==
@@ -2109,6 +3826,28 @@ int danton_run(struct danton_context * context, long events, long requested)
                 }
         }
 
+        /* Allocate the run state, if not already done. */
+        if (context_->run == NULL) {
+                context_->run = malloc(sizeof(*context_->run));
+                if (context_->run == NULL) {
+                        danton_error_push(context,
+                            "%s (%d): could not allocate memory.", __FILE__,
+                            __LINE__);
+                        return EXIT_FAILURE;
+                }
+        }
+        struct run_state * run = context_->run;
+
+        /* Get the local frame at the sampler location. It needs to be
+         * recomputed if the Earth model has changed since the sampler was
+         * updated.
+         */
+        if (sampler_->frame.geodesic != earth.geodesic)
+                sampler_frame_compute(
+                    sampler->latitude, sampler->longitude, &run->frame);
+        else
+                memcpy(&run->frame, &sampler_->frame, sizeof(run->frame));
+
         if ((!earth.is_flat) && (lock != NULL)) {
                 turtle_client_destroy(&context_->client);
                 enum turtle_return rc;
@@ -2119,18 +3858,6 @@ int danton_run(struct danton_context * context, long events, long requested)
                 }
         }
 
-        /* Temporary hack for the projectile. TODO: erase. */
-        int projectile = ENT_PID_NU_TAU;
-        if (context->mode != DANTON_MODE_GRAMMAGE) {
-                int j;
-                for (j = 0; j < DANTON_PARTICLE_N; j++) {
-                        if (sampler->weight[j] > 0.) {
-                                projectile = danton_particle_pdg(j);
-                                break;
-                        }
-                }
-        }
-
         /* Check for any custom run action and configure accordingly. */
         if (context->run_action != NULL)
                 context_->ent.stepping_action = &stepping_ent;
@@ -2188,177 +3915,91 @@ int danton_run(struct danton_context * context, long events, long requested)
                 }
                 context_->pumas->longitudinal = context->longitudinal;
 
-                /* Create the event record, if not already done.
-                 */
-                if (context_->record == NULL) {
-                        const int buffer_size = 10;
-                        context_->record = malloc(sizeof(*context_->record) +
-                            buffer_size * sizeof(*context_->record->product));
-                        if (context_->record == NULL) {
-                                danton_error_push(context,
-                                    "%s (%d): could not "
-                                    "allocate "
-                                    "memory.",
-                                    __FILE__, __LINE__);
-                                exit(EXIT_FAILURE);
-                        }
-                        context_->record->buffer_size = buffer_size;
-                        context_->record->api.vertex = NULL;
-                }
-
-                /* Configure the event record. TODO: according
-                 * to  options. */
-                context_->record->api.primary = &context_->record->primary;
-                context_->record->api.final = &context_->record->final;
+                /* Reset the arena of event records. */
+                if (arena_reset(context_) != EXIT_SUCCESS)
+                        return EXIT_FAILURE;
         }
 
         /* Configure the event count. */
-        if ((context->mode == DANTON_MODE_GRAMMAGE) || (requested <= 0))
+        if ((context->mode == DANTON_MODE_GRAMMAGE) || (requested <= 0)) {
                 requested = events;
-        n_published = 0;
+                context_->shared_published = NULL;
+        } else
+                context_->shared_published = context->published;
+        context_->requested = requested;
+        context_->n_published = 0;
+        context_->weight_sum = 0.;
+        context_->weight_sum2 = 0.;
+        run->events = events;
+        run->index = 0;
+        clock_gettime(CLOCK_MONOTONIC, &run->start);
+
+        /* Configure the sequence for generating backward events. */
+        if (context->mode == DANTON_MODE_BACKWARD) {
+                if ((context->sequence < 0) ||
+                    (context->sequence >= DANTON_SEQUENCE_N)) {
+                        danton_error_push(context,
+                            "%s (%d): invalid sequence (%d).", __FILE__,
+                            __LINE__, context->sequence);
+                        return EXIT_FAILURE;
+                }
+                if ((context->sequence == DANTON_SEQUENCE_LATIN_HYPERCUBE) &&
+                    (events > UINT32_MAX)) {
+                        danton_error_push(context,
+                            "%s (%d): too many events for a Latin "
+                            "hypercube.",
+                            __FILE__, __LINE__);
+                        return EXIT_FAILURE;
+                }
+                sequence_configure(context_, context->sequence, events);
+        } else
+                sequence_configure(context_, DANTON_SEQUENCE_RANDOM, events);
 
         /* Compute the generation cosine. */
-        double cos_theta[2];
         int l;
         for (l = 0; l < 2; l++)
-                cos_theta[l] = cos((90. - sampler->elevation[l]) * M_PI / 180.);
+                run->cos_theta[l] =
+                    cos((90. - sampler->elevation[l]) * M_PI / 180.);
 
-        /* Run the simulation. */
         if (context->mode == DANTON_MODE_FORWARD) {
                 /* Check the primary flux and pre-compute some
                  * sampling
                  * parameters.
                  */
-                double primary_p[DANTON_PARTICLE_N_NU];
+                double primary_w[DANTON_PARTICLE_N_NU];
                 int j;
                 struct danton_primary ** p;
                 for (j = 0, p = context->primary; j < DANTON_PARTICLE_N_NU;
-                     j++, p++) {
-                        double d;
-                        if (*p == NULL)
-                                d = 0.;
-                        else {
-                                d = (*p)->flux(*p, 0.);
-                                if (d < 0.) d = 0.;
-                        }
-                        if (j == 0)
-                                primary_p[0] = d;
-                        else
-                                primary_p[j] = primary_p[j - 1] + d;
-                }
-                if (primary_p[DANTON_PARTICLE_N_NU - 1] <= 0.) {
+                     j++, p++)
+                        primary_w[j] = (*p == NULL) ? 0. : (*p)->flux(*p, 0.);
+                alias_table_build(
+                    &run->primaries, DANTON_PARTICLE_N_NU, primary_w);
+                if (run->primaries.n == 0) {
                         danton_error_push(context,
                             "%s (%d): null primary flux.", __FILE__, __LINE__);
                         return EXIT_FAILURE;
                 }
 
-                /* Run a bunch of forward Monte-Carlo events. */
+                /* Configure for forward Monte-Carlo events. */
                 context_->ent.ancestor = NULL;
                 if (context_->pumas != NULL) context_->pumas->forward = 1;
                 context_->energy_cut = context->sampler->energy[0];
                 context_->pumas->kinetic_limit =
                     context_->energy_cut - tau_mass;
-
-                long i;
-                for (i = 0; (i < events) && (n_published < requested); i++) {
-                        /* Sample the projection of the primary state
-                         * uniformly.
-                         */
-                        const double ct =
-                            sample_linear(context_, cos_theta, i, 0, NULL);
-                        const double azimuth = sample_linear(
-                            context_, sampler->azimuth, i, 0, NULL);
-                        const double z0 = sampler->altitude[0];
-                        double ecef0[3], u0[3];
-                        compute_ecef_position(
-                            sampler->latitude, sampler->longitude, z0, ecef0);
-                        compute_ecef_direction(sampler->latitude,
-                            sampler->longitude, azimuth, ct, u0);
-
-                        /* Backward translate the primary state. */
-                        double a, b, r2;
-                        ellipsoid_parameters_intersection(
-                            ecef0, u0, &a, &b, &r2);
-                        b = -b;
-                        const double ri = 1. + 1.E+05 / PREM_EARTH_RADIUS;
-                        const double d2 = b * b + a * (ri * ri - r2);
-                        const double d = (d2 <= 0.) ? 0. : sqrt(d2);
-                        const double ds = (d - b) / a;
-                        ecef0[0] -= ds * u0[0];
-                        ecef0[1] -= ds * u0[1];
-                        ecef0[2] -= ds * u0[2];
-
-                        /* Sample the primary flavour and its
-                         * energy. */
-                        int j;
-                        double weight = 0., energy;
-                        while (weight == 0.) {
-                                const double u = random_uniform01(context_) *
-                                    primary_p[DANTON_PARTICLE_N_NU - 1];
-                                struct danton_primary ** p;
-                                for (j = 0, p = context->primary;
-                                     j < DANTON_PARTICLE_N_NU - 1; j++, p++)
-                                        if (u <= primary_p[j]) break;
-                                weight = 1.;
-                                energy = sample_log_or_linear(
-                                    context_, (*p)->energy, &weight);
-                                if ((weight > 0.) &&
-                                    ((*p)->energy[0] < (*p)->energy[1]))
-                                        weight *= (*p)->flux(*p, energy);
-                        }
-                        const int pid = danton_particle_pdg(j);
-
-                        /* Configure the primary state. */
-                        const int crossed = context_->flux_neutrino ? 0 : -1;
-                        struct generic_state state = {
-                                .base.ent = { pid, energy, 0., 0., weight,
-                                    { ecef0[0], ecef0[1], ecef0[2] },
-                                    { u0[0], u0[1], u0[2] } },
-                                .context = context_,
-                                .medium = -1,
-                                .density = 0.,
-                                .x = 0.,
-                                .is_tau = 0,
-                                .is_inside = -1,
-                                .has_crossed = crossed,
-                                .cross_count = 0
-                        };
-
-                        /* Initialise the event record. */
-                        context_->record->api.id = i;
-                        context_->record->api.weight = weight;
-                        context_->record->api.vertex = NULL;
-                        context_->record->api.n_products = 0;
-                        record_copy_ent(
-                            context_->record->api.primary, &state.base.ent);
-
-                        /* Call any custom initial run action. */
-                        if (context->run_action != NULL) {
-                                medium(state.base.ent.position,
-                                    state.base.ent.direction, &state);
-                                if (context->run_action(context,
-                                        DANTON_RUN_EVENT_START, state.medium,
-                                        context_->record->api.primary) !=
-                                    EXIT_SUCCESS)
-                                        return EXIT_FAILURE;
-                        }
-
-                        /* Do the Monte-Carlo simulation. */
-                        if (transport_forward(context_,
-                                (struct ent_state *)&state, 1) != EXIT_SUCCESS)
-                                return EXIT_FAILURE;
-
-                        /* Call any custom final run action. */
-                        if (context->run_action != NULL) {
-                                if (context->run_action(context,
-                                        DANTON_RUN_EVENT_STOP, -1,
-                                        context_->record->api.final) !=
-                                    EXIT_SUCCESS)
-                                        return EXIT_FAILURE;
-                        }
-                }
         } else {
-                /* Run a bunch of backward Monte-Carlo events.
+                /* Check the biasing parameters. */
+                const struct danton_biasing * biasing = &context->biasing;
+                if ((context->mode == DANTON_MODE_BACKWARD) &&
+                    ((biasing->decay <= 0.) || (biasing->grammage <= 0.) ||
+                        (biasing->recycle <= 0.) ||
+                        (biasing->recycle >= 1.))) {
+                        danton_error_push(context,
+                            "%s (%d): invalid biasing parameter(s).",
+                            __FILE__, __LINE__);
+                        return EXIT_FAILURE;
+                }
+
+                /* Configure for backward Monte-Carlo events.
                  */
                 context_->ent.ancestor = &ancestor_cb;
                 context_->energy_cut = context->sampler->energy[1];
@@ -2375,203 +4016,675 @@ int danton_run(struct danton_context * context, long events, long requested)
                         context_->pumas->kinetic_limit =
                             context_->energy_cut - tau_mass;
                 }
+        }
 
-                long i;
-                for (i = 0; (i < events) && (n_published < requested); i++) {
-                        double weight = 1.;
-                        const double ct = sample_linear(
-                            context_, cos_theta, i, events, &weight);
-                        const double azimuth = sample_linear(
-                            context_, sampler->azimuth, i, 0, &weight);
-                        if (sampler->azimuth[1] > sampler->azimuth[0])
-                                weight *= M_PI / 180.;
-                        const double energy = sample_log_or_linear(
-                            context_, sampler->energy, &weight);
-                        const double z0 = sample_log_or_linear(
-                            context_, sampler->altitude, &weight);
-
-                        if (context->mode != DANTON_MODE_GRAMMAGE) {
-                                context_->record->api.id = i;
-                                context_->record->api.generation = 1;
-                                context_->record->api.vertex = NULL;
-                                context_->record->api.n_products = 0;
-                        }
-                        if ((context->mode != DANTON_MODE_GRAMMAGE) &&
-                            !context_->flux_neutrino) {
-                                /* This is a particle Monte-Carlo. */
-                                const double charge =
-                                    (projectile > 0) ? -1. : 1.;
-                                double ecef0[3], u0[3];
-                                compute_ecef_position(sampler->latitude,
-                                    sampler->longitude, z0, ecef0);
-                                compute_ecef_direction(sampler->latitude,
-                                    sampler->longitude, azimuth, ct, u0);
-                                struct generic_state state = {
-                                        .base.pumas = { charge,
-                                            energy - tau_mass, 0., 0., 0.,
-                                            weight,
-                                            { ecef0[0], ecef0[1], ecef0[2] },
-                                            { u0[0], u0[1], u0[2] }, 0 },
-                                        .context = context_,
-                                        .medium = -1,
-                                        .density = 0.,
-                                        .x = 0.,
-                                        .is_tau = 1,
-                                        .is_inside = -1,
-                                        .has_crossed = -1,
-                                        .cross_count = 0
-                                };
-
-                                /* Call any custom initial run action. */
-                                if (context->run_action != NULL) {
-                                        medium(state.base.pumas.position,
-                                            state.base.pumas.direction, &state);
-                                        struct danton_state s;
-                                        record_copy_pumas(
-                                            &s, &state.base.pumas);
-                                        if (context->run_action(context,
-                                                DANTON_RUN_EVENT_START,
-                                                state.medium,
-                                                &s) != EXIT_SUCCESS)
-                                                return EXIT_FAILURE;
-                                }
+        return EXIT_SUCCESS;
+}
 
-                                if (transport_backward(context_, &state) !=
-                                    EXIT_SUCCESS)
-                                        return EXIT_FAILURE;
+/* Run a forward Monte-Carlo event. */
+static int run_forward(struct simulation_context * context_, long i)
+{
+        struct danton_context * context = &context_->api;
+        struct danton_sampler * sampler = context->sampler;
+        struct run_state * run = context_->run;
 
-                                /* Call any custom final run action. */
-                                if (context->run_action != NULL) {
-                                        if (context->run_action(context,
-                                                DANTON_RUN_EVENT_STOP, -1,
-                                                context_->record->api
-                                                    .primary) != EXIT_SUCCESS)
-                                                return EXIT_FAILURE;
-                                }
+        /* Each event has its own random stream. */
+        const long id = context->event_offset + i;
+        random_stream(context_, id);
 
-                        } else if ((context->mode != DANTON_MODE_GRAMMAGE) &&
-                            context_->flux_neutrino) {
-                                double ecef0[3], u0[3];
-                                compute_ecef_position(sampler->latitude,
-                                    sampler->longitude, z0, ecef0);
-                                compute_ecef_direction(sampler->latitude,
-                                    sampler->longitude, azimuth, ct, u0);
-                                struct generic_state state = {
-                                        .base.ent = { projectile, energy, 0.,
-                                            0., weight,
-                                            { ecef0[0], ecef0[1], ecef0[2] },
-                                            { u0[0], u0[1], u0[2] } },
-                                        .context = context_,
-                                        .medium = -1,
-                                        .density = 0.,
-                                        .x = 0.,
-                                        .is_tau = 0,
-                                        .is_inside = -1,
-                                        .has_crossed = -1,
-                                        .cross_count = 0
-                                };
-
-                                /* Call any custom initial run action. */
-                                if (context->run_action != NULL) {
-                                        medium(state.base.ent.position,
-                                            state.base.ent.direction, &state);
-                                        struct danton_state s;
-                                        record_copy_ent(&s, &state.base.ent);
-                                        if (context->run_action(context,
-                                                DANTON_RUN_EVENT_START,
-                                                state.medium,
-                                                &s) != EXIT_SUCCESS)
-                                                return EXIT_FAILURE;
-                                }
+        /* Sample the projection of the primary state
+         * uniformly.
+         */
+        const double ct = sample_linear(
+            context_, run->cos_theta, i, 0, SEQUENCE_ELEVATION, NULL);
+        const double azimuth = sample_linear(
+            context_, sampler->azimuth, i, 0, SEQUENCE_AZIMUTH, NULL);
+        const double z0 = sampler->altitude[0];
+        double ecef0[3], u0[3];
+        sampler_frame_position(&run->frame, z0, ecef0);
+        sampler_frame_direction(&run->frame, azimuth, ct, u0);
+
+        /* Backward translate the primary state. */
+        double a, b, r2;
+        ellipsoid_parameters_intersection(ecef0, u0, &a, &b, &r2);
+        b = -b;
+        const double ri = 1. + 1.E+05 / PREM_EARTH_RADIUS;
+        const double d2 = b * b + a * (ri * ri - r2);
+        const double d = (d2 <= 0.) ? 0. : sqrt(d2);
+        const double ds = (d - b) / a;
+        ecef0[0] -= ds * u0[0];
+        ecef0[1] -= ds * u0[1];
+        ecef0[2] -= ds * u0[2];
+
+        /* Sample the primary flavour and its
+         * energy. */
+        const int j = alias_table_sample(context_, &run->primaries, NULL);
+        struct danton_primary * p = context->primary[j];
+        double weight = 0., energy;
+        if (p->sample != NULL) {
+                /* Sample the energy from the model
+                 * itself.
+                 */
+                double pdf;
+                energy = p->sample(p, random_uniform01(context_), &pdf);
+                if (p->energy[0] >= p->energy[1])
+                        weight = 1.;
+                else if (pdf > 0.)
+                        weight = p->flux(p, energy) / pdf;
+        } else {
+                weight = 1.;
+                energy = sample_log_or_linear(
+                    context_, p->energy, i, SEQUENCE_ENERGY, &weight);
+                if ((weight > 0.) && (p->energy[0] < p->energy[1]))
+                        weight *= p->flux(p, energy);
+        }
+        if (!(weight > 0.)) return EXIT_SUCCESS;
+        const int pid = danton_particle_pdg(j);
+
+        /* Configure the primary state. */
+        const int crossed = context_->flux_neutrino ? 0 : -1;
+        struct generic_state state = {
+                .base.ent = { pid, energy, 0., 0., weight,
+                    { ecef0[0], ecef0[1], ecef0[2] },
+                    { u0[0], u0[1], u0[2] } },
+                .context = context_,
+                .medium = -1,
+                .density = 0.,
+                .x = 0.,
+                .is_tau = 0,
+                .is_inside = -1,
+                .has_crossed = crossed,
+                .cross_count = 0
+        };
 
-                                if (transport_backward(context_, &state) !=
-                                    EXIT_SUCCESS)
-                                        return EXIT_FAILURE;
+        /* Initialise the event record. */
+        context_->record->api.id = id;
+        context_->record->api.weight = weight;
+        context_->record->api.vertex = NULL;
+        context_->record->api.n_products = 0;
+        record_copy_ent(context_->record->api.primary, &state.base.ent);
 
-                                /* Call any custom final run action. */
-                                if (context->run_action != NULL) {
-                                        if (context->run_action(context,
-                                                DANTON_RUN_EVENT_STOP, -1,
-                                                context_->record->api
-                                                    .primary) != EXIT_SUCCESS)
-                                                return EXIT_FAILURE;
-                                }
+        /* Call any custom initial run action. */
+        if (context->run_action != NULL) {
+                medium(state.base.ent.position, state.base.ent.direction,
+                    &state);
+                if (context->run_action(context, DANTON_RUN_EVENT_START,
+                        state.medium,
+                        context_->record->api.primary) != EXIT_SUCCESS)
+                        return EXIT_FAILURE;
+        }
 
-                        } else {
-                                /* This is a grammage scan using
-                                 * a non-interacting neutrino. First
-                                 * let us initialise the neutrino state.
-                                 */
-                                double ecef0[3], u0[3];
-                                compute_ecef_position(sampler->latitude,
-                                    sampler->longitude, z0, ecef0);
-                                compute_ecef_direction(sampler->latitude,
-                                    sampler->longitude, azimuth, ct, u0);
-                                struct generic_state g_state = {
-                                        .base.ent = { projectile, energy, 0.,
-                                            0., weight,
-                                            { ecef0[0], ecef0[1], ecef0[2] },
-                                            { u0[0], u0[1], u0[2] } },
-                                        .context = context_,
-                                        .medium = -1,
-                                        .density = 0.,
-                                        .x = 0.,
-                                        .is_tau = 0,
-                                        .is_inside = -1,
-                                        .has_crossed = -1,
-                                        .cross_count = 0
-                                };
-
-                                /* Call any custom initial run action. */
-                                struct ent_state * state = &g_state.base.ent;
-                                if (context->run_action != NULL) {
-                                        medium(g_state.base.ent.position,
-                                            g_state.base.ent.direction,
-                                            &g_state);
-                                        struct danton_state s;
-                                        record_copy_ent(&s, state);
-                                        if (context->run_action(context,
-                                                DANTON_RUN_EVENT_START,
-                                                g_state.medium,
-                                                &s) != EXIT_SUCCESS)
-                                                return EXIT_FAILURE;
-                                }
+        /* Do the Monte-Carlo simulation. */
+        if (transport_forward(context_, (struct ent_state *)&state, 1) !=
+            EXIT_SUCCESS)
+                return EXIT_FAILURE;
 
-                                /* Then let us do the transport
-                                 * with ENT.
-                                 */
-                                enum ent_event event = ENT_EVENT_NONE;
-                                while (event != ENT_EVENT_EXIT) {
-                                        ent_transport(NULL, &context_->ent,
-                                            state, NULL, &event);
-                                }
+        /* Call any custom final run action. */
+        if (context->run_action != NULL) {
+                if (context->run_action(context, DANTON_RUN_EVENT_STOP, -1,
+                        context_->record->api.final) != EXIT_SUCCESS)
+                        return EXIT_FAILURE;
+        }
 
-                                /* Call any custom final run action. */
-                                if (context->run_action != NULL) {
-                                        struct danton_state s;
-                                        record_copy_ent(&s, state);
-                                        if (context->run_action(context,
-                                                DANTON_RUN_EVENT_STOP, -1,
-                                                &s) != EXIT_SUCCESS)
-                                                return EXIT_FAILURE;
-                                }
+        return EXIT_SUCCESS;
+}
 
-                                /* Finally, let us publish the
-                                 * result.
-                                 */
-                                struct danton_grammage g = { 90. -
-                                            acos(ct) / M_PI * 180.,
-                                        state->grammage };
-                                if (context->recorder->record_grammage(context,
-                                        context->recorder, &g) != EXIT_SUCCESS)
-                                        return EXIT_FAILURE;
+/* Run a backward Monte-Carlo event, or a grammage scan point. */
+static int run_backward(struct simulation_context * context_, long i)
+{
+        struct danton_context * context = &context_->api;
+        struct danton_sampler * sampler = context->sampler;
+        struct event_sampler * sampler_ = (struct event_sampler *)sampler;
+        struct run_state * run = context_->run;
+
+        /* Each event has its own random stream. */
+        const long id = context->event_offset + i;
+        random_stream(context_, id);
+
+        double weight = 1.;
+        const double ct = sample_linear(context_, run->cos_theta, i,
+            run->events, SEQUENCE_ELEVATION, &weight);
+        const double azimuth = sample_linear(
+            context_, sampler->azimuth, i, 0, SEQUENCE_AZIMUTH, &weight);
+        if (sampler->azimuth[1] > sampler->azimuth[0]) weight *= M_PI / 180.;
+        const double energy = sample_log_or_linear(
+            context_, sampler->energy, i, SEQUENCE_ENERGY, &weight);
+        const double z0 = sample_log_or_linear(
+            context_, sampler->altitude, i, SEQUENCE_ALTITUDE, &weight);
+        double ecef0[3], u0[3];
+        sampler_frame_position(&run->frame, z0, ecef0);
+        sampler_frame_direction(&run->frame, azimuth, ct, u0);
+
+        /* Sample the final tau. Neutrino weights are ignored. */
+        int projectile = ENT_PID_NU_TAU;
+        if (context->mode != DANTON_MODE_GRAMMAGE) {
+                double p;
+                projectile = danton_particle_pdg(
+                    alias_table_sample(context_, &sampler_->taus, &p));
+                weight /= p;
+        }
+
+        if (context->mode != DANTON_MODE_GRAMMAGE) {
+                context_->record->api.id = id;
+                context_->record->api.generation = 1;
+                context_->record->api.vertex = NULL;
+                context_->record->api.n_products = 0;
+        }
+        if ((context->mode != DANTON_MODE_GRAMMAGE) &&
+            !context_->flux_neutrino) {
+                /* This is a particle Monte-Carlo. */
+                const double charge = (projectile > 0) ? -1. : 1.;
+                struct generic_state state = {
+                        .base.pumas = { charge, energy - tau_mass, 0., 0., 0.,
+                            weight, { ecef0[0], ecef0[1], ecef0[2] },
+                            { u0[0], u0[1], u0[2] }, 0 },
+                        .context = context_,
+                        .medium = -1,
+                        .density = 0.,
+                        .x = 0.,
+                        .is_tau = 1,
+                        .is_inside = -1,
+                        .has_crossed = -1,
+                        .cross_count = 0
+                };
+
+                /* Call any custom initial run action. */
+                if (context->run_action != NULL) {
+                        medium(state.base.pumas.position,
+                            state.base.pumas.direction, &state);
+                        struct danton_state s;
+                        record_copy_pumas(&s, &state.base.pumas);
+                        if (context->run_action(context,
+                                DANTON_RUN_EVENT_START, state.medium,
+                                &s) != EXIT_SUCCESS)
+                                return EXIT_FAILURE;
+                }
+
+                if (transport_backward(context_, &state) != EXIT_SUCCESS)
+                        return EXIT_FAILURE;
+
+                /* Call any custom final run action. */
+                if (context->run_action != NULL) {
+                        if (context->run_action(context, DANTON_RUN_EVENT_STOP,
+                                -1, context_->record->api.primary) !=
+                            EXIT_SUCCESS)
+                                return EXIT_FAILURE;
+                }
+
+        } else if ((context->mode != DANTON_MODE_GRAMMAGE) &&
+            context_->flux_neutrino) {
+                struct generic_state state = {
+                        .base.ent = { projectile, energy, 0., 0., weight,
+                            { ecef0[0], ecef0[1], ecef0[2] },
+                            { u0[0], u0[1], u0[2] } },
+                        .context = context_,
+                        .medium = -1,
+                        .density = 0.,
+                        .x = 0.,
+                        .is_tau = 0,
+                        .is_inside = -1,
+                        .has_crossed = -1,
+                        .cross_count = 0
+                };
+
+                /* Call any custom initial run action. */
+                if (context->run_action != NULL) {
+                        medium(state.base.ent.position,
+                            state.base.ent.direction, &state);
+                        struct danton_state s;
+                        record_copy_ent(&s, &state.base.ent);
+                        if (context->run_action(context,
+                                DANTON_RUN_EVENT_START, state.medium,
+                                &s) != EXIT_SUCCESS)
+                                return EXIT_FAILURE;
+                }
+
+                if (transport_backward(context_, &state) != EXIT_SUCCESS)
+                        return EXIT_FAILURE;
+
+                /* Call any custom final run action. */
+                if (context->run_action != NULL) {
+                        if (context->run_action(context, DANTON_RUN_EVENT_STOP,
+                                -1, context_->record->api.primary) !=
+                            EXIT_SUCCESS)
+                                return EXIT_FAILURE;
+                }
+
+        } else if ((context->run_action == NULL) && grammage_is_analytic()) {
+                /* This is a grammage scan over a spherical
+                 * Earth. The grammage is integrated directly
+                 * along the backward direction.
+                 */
+                const double v[3] = { -u0[0], -u0[1], -u0[2] };
+                struct danton_grammage g = { 90. - acos(ct) / M_PI * 180.,
+                        grammage_compute(ecef0, v) };
+                if (context->recorder->record_grammage(
+                        context, context->recorder, &g) != EXIT_SUCCESS)
+                        return EXIT_FAILURE;
+        } else {
+                /* This is a grammage scan using
+                 * a non-interacting neutrino. First
+                 * let us initialise the neutrino state.
+                 */
+                struct generic_state g_state = {
+                        .base.ent = { projectile, energy, 0., 0., weight,
+                            { ecef0[0], ecef0[1], ecef0[2] },
+                            { u0[0], u0[1], u0[2] } },
+                        .context = context_,
+                        .medium = -1,
+                        .density = 0.,
+                        .x = 0.,
+                        .is_tau = 0,
+                        .is_inside = -1,
+                        .has_crossed = -1,
+                        .cross_count = 0
+                };
+
+                /* Call any custom initial run action. */
+                struct ent_state * state = &g_state.base.ent;
+                if (context->run_action != NULL) {
+                        medium(g_state.base.ent.position,
+                            g_state.base.ent.direction, &g_state);
+                        struct danton_state s;
+                        record_copy_ent(&s, state);
+                        if (context->run_action(context,
+                                DANTON_RUN_EVENT_START, g_state.medium,
+                                &s) != EXIT_SUCCESS)
+                                return EXIT_FAILURE;
+                }
+
+                /* Then let us do the transport
+                 * with ENT.
+                 */
+                enum ent_event event = ENT_EVENT_NONE;
+                while (event != ENT_EVENT_EXIT) {
+                        ent_transport(
+                            NULL, &context_->ent, state, NULL, &event);
+                }
+
+                /* Call any custom final run action. */
+                if (context->run_action != NULL) {
+                        struct danton_state s;
+                        record_copy_ent(&s, state);
+                        if (context->run_action(context, DANTON_RUN_EVENT_STOP,
+                                -1, &s) != EXIT_SUCCESS)
+                                return EXIT_FAILURE;
+                }
+
+                /* Finally, let us publish the
+                 * result.
+                 */
+                struct danton_grammage g = { 90. - acos(ct) / M_PI * 180.,
+                        state->grammage };
+                if (context->recorder->record_grammage(
+                        context, context->recorder, &g) != EXIT_SUCCESS)
+                        return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+}
+
+/* Check if the current run has converged, or if its time budget is
+ * exhausted.
+ */
+static int run_converged(struct simulation_context * context)
+{
+#define PRECISION_MIN_EVENTS 100
+        struct run_state * run = context->run;
+        const double precision = context->api.precision;
+        if (precision > 0.) {
+                /* Get the totals of the run, over all contexts sharing a
+                 * tally.
+                 */
+                struct danton_tally total = { run->index,
+                        context->n_published, context->weight_sum,
+                        context->weight_sum2 };
+                if (context->api.tally != NULL) {
+                        if (lock != NULL) lock();
+                        total = *context->api.tally;
+                        if (unlock != NULL) unlock();
+                }
+
+                /* The relative variance of the mean weight, per generated
+                 * event.
+                 */
+                if ((total.published >= PRECISION_MIN_EVENTS) &&
+                    (total.weight_sum > 0.)) {
+                        const double s1 = total.weight_sum;
+                        const double r2 = total.weight_sum2 / (s1 * s1) -
+                            1. / total.events;
+                        if (r2 < precision * precision) return 1;
+                }
+        }
+
+        const double time_limit = context->api.time_limit;
+        if (time_limit > 0.) {
+                struct timespec t;
+                clock_gettime(CLOCK_MONOTONIC, &t);
+                const double dt = (t.tv_sec - run->start.tv_sec) +
+                    1E-09 * (t.tv_nsec - run->start.tv_nsec);
+                if (dt >= time_limit) return 1;
+        }
+
+        return 0;
+#undef PRECISION_MIN_EVENTS
+}
+
+/* Run the next events of the current run. If *pending* is positive, the run
+ * stops as soon as that many events are pending in the batch buffer.
+ */
+static int run_events(struct simulation_context * context, long pending)
+{
+        struct run_state * run = context->run;
+        int (*run_event)(struct simulation_context *, long) =
+            (context->api.mode == DANTON_MODE_FORWARD) ? &run_forward :
+                                                         &run_backward;
+        while ((run->index < run->events) &&
+            (record_published(context) < context->requested) &&
+            !run_converged(context)) {
+                if ((pending > 0) &&
+                    (context->arena.n - context->arena.consumed >= pending))
+                        break;
+                context->stats.events++;
+                if (context->api.tally != NULL)
+                        counter_fetch_add(&context->api.tally->events);
+                if (run_event(context, run->index++) != EXIT_SUCCESS)
+                        return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+}
+
+/* Run a DANTON simulation. */
+int danton_run(struct danton_context * context, long events, long requested)
+{
+        struct simulation_context * context_ =
+            (struct simulation_context *)context;
+        if (context->recorder == NULL) {
+                danton_error_push(context, "%s (%d): no recorder was provided.",
+                    __FILE__, __LINE__);
+                return EXIT_FAILURE;
+        }
+        if (run_configure(context_, events, requested) != EXIT_SUCCESS)
+                return EXIT_FAILURE;
+        return run_events(context_, 0);
+}
+
+/* Start a simulation run, for pulling events by batches. */
+int danton_run_begin(
+    struct danton_context * context, long events, long requested)
+{
+        struct simulation_context * context_ =
+            (struct simulation_context *)context;
+        if (context->mode == DANTON_MODE_GRAMMAGE) {
+                danton_error_push(context,
+                    "%s (%d): grammage scans cannot be pulled.", __FILE__,
+                    __LINE__);
+                return EXIT_FAILURE;
+        }
+        if (run_configure(context_, events, requested) != EXIT_SUCCESS)
+                return EXIT_FAILURE;
+        context_->arena.batch = 1;
+        return EXIT_SUCCESS;
+}
+
+/* Pull the next batch of events of the current run. */
+long danton_next_events(
+    struct danton_context * context, struct danton_event * events, long n)
+{
+        struct simulation_context * context_ =
+            (struct simulation_context *)context;
+        if (!context_->arena.batch) {
+                danton_error_push(context, "%s (%d): no run in progress.",
+                    __FILE__, __LINE__);
+                return -1;
+        }
+        if (n <= 0) return 0;
+
+        /* Discard the events of the previous batch and run until enough
+         * events are pending.
+         */
+        if ((arena_compact(context_) != EXIT_SUCCESS) ||
+            (run_events(context_, n) != EXIT_SUCCESS))
+                return -1;
+
+        /* Expose the pending events. */
+        long i;
+        for (i = 0; (i < n) && (context_->arena.consumed < context_->arena.n);
+             i++)
+                arena_consume(context_, events + i);
+        return i;
+}
+
+/* Terminate a run of pulled events. */
+void danton_run_end(struct danton_context * context)
+{
+        struct simulation_context * context_ =
+            (struct simulation_context *)context;
+        if (context_->arena.batch) arena_reset(context_);
+}
+
+/* Run backward trial events and compute the efficiency of the current
+ * biasing, i.e. the inverse of the relative variance of the weights per unit
+ * of CPU time.
+ */
+static int biasing_efficiency(
+    struct simulation_context * context, long events, double * efficiency)
+{
+        context->n_published = 0;
+        context->weight_sum = 0.;
+        context->weight_sum2 = 0.;
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t0);
+        long i;
+        for (i = 0; i < events; i++) {
+                if (run_backward(context, i) != EXIT_SUCCESS)
+                        return EXIT_FAILURE;
+        }
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t1);
+        const double dt =
+            (t1.tv_sec - t0.tv_sec) + 1E-09 * (t1.tv_nsec - t0.tv_nsec);
+
+        *efficiency = 0.;
+        const double s1 = context->weight_sum;
+        if ((s1 <= 0.) || (dt <= 0.)) return EXIT_SUCCESS;
+        double v = events * context->weight_sum2 / (s1 * s1) - 1.;
+        if (v < DBL_EPSILON) v = DBL_EPSILON;
+        *efficiency = events / (v * dt);
+        return EXIT_SUCCESS;
+}
+
+/* Tune the biasing parameters of backward Monte-Carlo runs. */
+int danton_biasing_tune(struct danton_context * context, long events)
+{
+        struct simulation_context * context_ =
+            (struct simulation_context *)context;
+        if (context->mode != DANTON_MODE_BACKWARD) {
+                danton_error_push(context,
+                    "%s (%d): biasing only applies to backward runs.",
+                    __FILE__, __LINE__);
+                return EXIT_FAILURE;
+        }
+        if (events <= 0) return EXIT_SUCCESS;
+
+        /* Custom run actions are disabled during the trials. */
+        danton_run_cb * run_action = context->run_action;
+        context->run_action = NULL;
+        if (run_configure(context_, events, 0) != EXIT_SUCCESS) {
+                context->run_action = run_action;
+                return EXIT_FAILURE;
+        }
+
+        /* The trial values of the biasing parameters. */
+        static const double decay[] = { 1., 2., 4., 6., 10., 20. };
+        static const double grammage[] = { 1E+06, 3E+06, 1E+07, 3E+07, 1E+08,
+                3E+08 };
+        static const double recycle[] = { 0.01, 0.03, 0.1, 0.3, 0.5 };
+        struct {
+                double * value;
+                const double * trial;
+                int n;
+        } parameter[] = {
+                { &context->biasing.decay, decay,
+                    sizeof(decay) / sizeof(*decay) },
+                { &context->biasing.grammage, grammage,
+                    sizeof(grammage) / sizeof(*grammage) },
+                { &context->biasing.recycle, recycle,
+                    sizeof(recycle) / sizeof(*recycle) }
+        };
+
+        /* Optimise one parameter at a time, starting from the current
+         * values. Trial events are run with negative indices, in order not
+         * to overlap with the events of a run.
+         */
+        const long offset = context->event_offset;
+        context->event_offset = -events;
+        context_->tuning = 1;
+
+        /* Trials are not accounted for in the run statistics. */
+        struct danton_stats stats;
+        memcpy(&stats, &context_->stats, sizeof(stats));
+        double best;
+        int rc = biasing_efficiency(context_, events, &best);
+        int i;
+        for (i = 0; (rc == EXIT_SUCCESS) &&
+             (i < (int)(sizeof(parameter) / sizeof(*parameter)));
+             i++) {
+                const double initial = *parameter[i].value;
+                double selected = initial;
+                int j;
+                for (j = 0; j < parameter[i].n; j++) {
+                        if (parameter[i].trial[j] == initial) continue;
+                        *parameter[i].value = parameter[i].trial[j];
+                        double efficiency;
+                        rc = biasing_efficiency(context_, events, &efficiency);
+                        if (rc != EXIT_SUCCESS) break;
+                        if (efficiency > best) {
+                                best = efficiency;
+                                selected = parameter[i].trial[j];
                         }
                 }
+                *parameter[i].value = selected;
         }
+        context_->tuning = 0;
+        context->event_offset = offset;
+        context->run_action = run_action;
+        memcpy(&context_->stats, &stats, sizeof(stats));
 
+        return rc;
+}
+
+/* Compute the grammage along a line of sight by stepping a non-interacting
+ * neutrino backwards with ENT.
+ */
+static int grammage_transport(struct simulation_context * context,
+    const double * position, const double * direction, double * grammage)
+{
+        struct generic_state g_state = {
+                .base.ent = { ENT_PID_NU_TAU, 1E+09, 0., 0., 1.,
+                    { position[0], position[1], position[2] },
+                    { direction[0], direction[1], direction[2] } },
+                .context = context,
+                .medium = -1,
+                .density = 0.,
+                .x = 0.,
+                .is_tau = 0,
+                .is_inside = -1,
+                .has_crossed = -1,
+                .cross_count = 0
+        };
+        struct ent_state * state = &g_state.base.ent;
+        enum ent_event event = ENT_EVENT_NONE;
+        while (event != ENT_EVENT_EXIT) {
+                enum ent_return rc;
+                if ((rc = ent_transport(NULL, &context->ent, state, NULL,
+                         &event)) != ENT_RETURN_SUCCESS) {
+                        ERROR_ENT(&context->api, rc, ent_transport);
+                        return EXIT_FAILURE;
+                }
+        }
+        *grammage = state->grammage;
         return EXIT_SUCCESS;
 }
 
+/* Compute the grammage for a batch of lines of sight. */
+int danton_grammage_batch(struct danton_context * context, long n,
+    const double * latitude, const double * longitude,
+    const double * altitude, const double * azimuth,
+    const double * elevation, double * grammage)
+{
+        struct simulation_context * context_ =
+            (struct simulation_context *)context;
+
+        if (n <= 0) return EXIT_SUCCESS;
+        if ((latitude == NULL) || (longitude == NULL) || (azimuth == NULL) ||
+            (elevation == NULL) || (grammage == NULL)) {
+                danton_error_push(context, "%s (%d): missing input data.",
+                    __FILE__, __LINE__);
+                return EXIT_FAILURE;
+        }
+
+        /* Configure the stepping, if the grammage cannot be computed
+         * analytically. The ENT hooks of the context are restored on exit.
+         */
+        const int analytic = grammage_is_analytic();
+        ent_ancestor_cb * ancestor = context_->ent.ancestor;
+        ent_stepping_cb * stepping_action = context_->ent.stepping_action;
+        if (!analytic) {
+                if ((!earth.is_flat) && (lock != NULL) &&
+                    (context_->client == NULL)) {
+                        enum turtle_return rc;
+                        if ((rc = turtle_client_create(earth.datum,
+                                 &context_->client)) !=
+                            TURTLE_RETURN_SUCCESS) {
+                                ERROR_TURTLE(context, rc, turtle_client_create);
+                                return EXIT_FAILURE;
+                        }
+                }
+                context_->ent.ancestor = &ancestor_cb;
+                context_->ent.stepping_action = NULL;
+        }
+
+        /* Loop over the lines of sight. */
+        struct sampler_frame frame;
+        int rc = EXIT_SUCCESS;
+        long i;
+        for (i = 0; i < n; i++) {
+                if ((latitude[i] < -90.) || (latitude[i] > 90.) ||
+                    (elevation[i] < -90.) || (elevation[i] > 90.)) {
+                        danton_error_push(context,
+                            "%s (%d): invalid angle(s) for line of sight %ld.",
+                            __FILE__, __LINE__, i);
+                        rc = EXIT_FAILURE;
+                        break;
+                }
+
+                /* Update the local frame if the site has changed. */
+                if ((i == 0) || (latitude[i] != latitude[i - 1]) ||
+                    (longitude[i] != longitude[i - 1]))
+                        sampler_frame_compute(
+                            latitude[i], longitude[i], &frame);
+
+                double position[3], direction[3];
+                const double z = (altitude == NULL) ? 0. : altitude[i];
+                sampler_frame_position(&frame, z, position);
+                const double c = sin(elevation[i] * M_PI / 180.);
+                sampler_frame_direction(&frame, azimuth[i], c, direction);
+
+                if (analytic) {
+                        direction[0] = -direction[0];
+                        direction[1] = -direction[1];
+                        direction[2] = -direction[2];
+                        grammage[i] = grammage_compute(position, direction);
+                } else if ((rc = grammage_transport(context_, position,
+                                direction, grammage + i)) != EXIT_SUCCESS)
+                        break;
+        }
+
+        context_->ent.ancestor = ancestor;
+        context_->ent.stepping_action = stepping_action;
+        return rc;
+}
+
 /* Global error buffer. */
 static struct error_stack g_error = { 0, 0, "" };
 
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2017 Université Clermont Auvergne, CNRS/IN2P3, LPC
+ * Author: Valentin NIESS (niess@in2p3.fr)
+ *
+ * This software is a C99 executable dedicated to the sampling of decaying
+ * taus from ultra high energy neutrinos.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/* Standard library includes. */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* The DANTON API. */
+#include "danton.h"
+#include "danton/primary/brokenlaw.h"
+
+/* Data container for a broken power law spectrum. */
+struct danton_brokenlaw {
+        struct danton_primary base;
+        double weight;
+        /* The number of segments. */
+        int n;
+        /* The energy bounds of the segments. */
+        double * energy;
+        /* The exponent of each segment. */
+        double * exponent;
+        /* The pre-computed pdf normalisation of each segment, such that the
+         * pdf is `normalisation * (E / E0)^exponent` with `E0` the lower
+         * bound of the segment.
+         */
+        double * normalisation;
+        /* The cumulative probability at the segments bounds. */
+        double * cdf;
+        /* Placeholder for the tables. */
+        double data[];
+};
+
+/* Locate the segment of an energy value. */
+static int locate(const struct danton_brokenlaw * brokenlaw, double energy)
+{
+        int i;
+        for (i = 0; i < brokenlaw->n - 1; i++)
+                if (energy < brokenlaw->energy[i + 1]) break;
+        return i;
+}
+
+/* Flux callback for the broken power law spectrum. */
+static double flux(struct danton_primary * primary, double energy)
+{
+        struct danton_brokenlaw * brokenlaw =
+            (struct danton_brokenlaw *)primary;
+        if (energy > 0.) {
+                if ((energy < brokenlaw->base.energy[0]) ||
+                    (energy > brokenlaw->base.energy[1]))
+                        return 0.;
+                const int i = locate(brokenlaw, energy);
+                const double x = energy / brokenlaw->energy[i];
+                return brokenlaw->weight * brokenlaw->normalisation[i] *
+                    pow(x, brokenlaw->exponent[i]);
+        } else
+                return brokenlaw->weight;
+}
+
+/* Sampling callback for the broken power law spectrum. */
+static double sample(struct danton_primary * primary, double u, double * pdf)
+{
+        struct danton_brokenlaw * brokenlaw =
+            (struct danton_brokenlaw *)primary;
+
+        /* Locate the segment from the cumulative probability. */
+        int i;
+        for (i = 0; i < brokenlaw->n - 1; i++)
+                if (u < brokenlaw->cdf[i + 1]) break;
+
+        /* Invert the power law integral over the segment. */
+        const double e0 = brokenlaw->energy[i];
+        const double c = brokenlaw->normalisation[i];
+        const double a1 = brokenlaw->exponent[i] + 1.;
+        const double t = (u - brokenlaw->cdf[i]) / (c * e0);
+        double energy =
+            (a1 == 0.) ? e0 * exp(t) : e0 * pow(1. + a1 * t, 1. / a1);
+        if (!(energy > e0))
+                energy = e0;
+        else if (energy > brokenlaw->energy[i + 1])
+                energy = brokenlaw->energy[i + 1];
+        *pdf = c * pow(energy / e0, brokenlaw->exponent[i]);
+        return energy;
+}
+
+/* API function for creating a new broken power law spectrum. */
+struct danton_brokenlaw * danton_brokenlaw_create(
+    int n, const double * energy, const double * exponent, double weight)
+{
+        /* Check the arguments. */
+        if ((n < 1) || (energy == NULL) || (exponent == NULL) ||
+            (weight < 0.)) {
+                danton_error_push(NULL, "%s (%d): invalid argument(s).",
+                    __FILE__, __LINE__);
+                return NULL;
+        }
+        int i;
+        for (i = 0; i <= n; i++) {
+                if ((energy[i] <= 0.) ||
+                    ((i > 0) && (energy[i] <= energy[i - 1]))) {
+                        danton_error_push(NULL,
+                            "%s (%d): invalid energy bound (%.5lE).", __FILE__,
+                            __LINE__, energy[i]);
+                        return NULL;
+                }
+        }
+
+        /* Allocate the memory for the new broken power law spectrum. */
+        struct danton_brokenlaw * brokenlaw;
+        const size_t size =
+            sizeof(*brokenlaw) + (4 * n + 2) * sizeof(*brokenlaw->data);
+        if ((brokenlaw = malloc(size)) == NULL) {
+                danton_error_push(NULL, "%s (%d): could not allocate memory.",
+                    __FILE__, __LINE__);
+                return NULL;
+        }
+        brokenlaw->n = n;
+        brokenlaw->energy = brokenlaw->data;
+        brokenlaw->exponent = brokenlaw->energy + n + 1;
+        brokenlaw->normalisation = brokenlaw->exponent + n;
+        brokenlaw->cdf = brokenlaw->normalisation + n;
+
+        /* Pre-compute the normalisation of the segments, enforcing the
+         * continuity at the breaks.
+         */
+        double c = 1.;
+        brokenlaw->cdf[0] = 0.;
+        for (i = 0; i < n; i++) {
+                const double e0 = energy[i];
+                const double r = energy[i + 1] / e0;
+                const double a1 = exponent[i] + 1.;
+                brokenlaw->energy[i] = e0;
+                brokenlaw->exponent[i] = exponent[i];
+                brokenlaw->normalisation[i] = c;
+                const double I = c * e0 *
+                    ((a1 == 0.) ? log(r) : (pow(r, a1) - 1.) / a1);
+                brokenlaw->cdf[i + 1] = brokenlaw->cdf[i] + I;
+                c *= pow(r, exponent[i]);
+        }
+        brokenlaw->energy[n] = energy[n];
+
+        const double total = brokenlaw->cdf[n];
+        for (i = 0; i < n; i++) {
+                brokenlaw->normalisation[i] /= total;
+                brokenlaw->cdf[i + 1] /= total;
+        }
+
+        /* Initialise the base primary and return. */
+        brokenlaw->base.flux = &flux;
+        brokenlaw->base.sample = &sample;
+        brokenlaw->base.energy[0] = energy[0];
+        brokenlaw->base.energy[1] = energy[n];
+        brokenlaw->weight = weight;
+
+        return brokenlaw;
+}
+
+/* API function for checking for a broken power law type. */
+int danton_brokenlaw_check(struct danton_primary * primary)
+{
+        return (primary->flux == &flux);
+}
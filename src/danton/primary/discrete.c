@@ -45,6 +45,13 @@ static double flux(struct danton_primary * primary, double energy)
         }
 }
 
+/* Sampling callback for the discrete spectrum. */
+static double sample(struct danton_primary * primary, double u, double * pdf)
+{
+        *pdf = 1.;
+        return primary->energy[0];
+}
+
 /* API function for setting the parameters of a discrete spectrum. */
 int danton_discrete_set(
     struct danton_discrete * discrete, double energy, double weight)
@@ -81,6 +88,7 @@ struct danton_discrete * danton_discrete_create(double energy, double weight)
 
         /* Initialise the discrete spectrum and return. */
         discrete->base.flux = &flux;
+        discrete->base.sample = &sample;
         danton_discrete_set(discrete, energy, weight);
         return discrete;
 }
@@ -33,24 +33,72 @@ static double flux(struct danton_primary * primary, double energy)
 {
         struct danton_powerlaw * powerlaw = (struct danton_powerlaw *)primary;
         if (energy > 0.) {
-                double pdf;
-                if (powerlaw->base.energy[0] == powerlaw->base.energy[1])
-                        pdf = 0.;
-                else if (powerlaw->exponent == -1.) {
-                        const double r = log(powerlaw->base.energy[1] /
-                            powerlaw->base.energy[0]);
-                        pdf = 1. / (r * energy);
-                } else {
-                        const double a1 = powerlaw->exponent + 1.;
-                        const double r = pow(powerlaw->base.energy[1], a1) -
-                            pow(powerlaw->base.energy[0], a1);
-                        pdf = a1 * pow(energy, powerlaw->exponent) / r;
-                }
-                return powerlaw->weight * pdf;
+                const double x = energy / powerlaw->base.energy[0];
+                return powerlaw->weight * powerlaw->normalisation *
+                    pow(x, powerlaw->exponent);
         } else
                 return powerlaw->weight;
 }
 
+/* Sampling callback for the power law spectrum. */
+static double sample(struct danton_primary * primary, double u, double * pdf)
+{
+        struct danton_powerlaw * powerlaw = (struct danton_powerlaw *)primary;
+        const double e0 = powerlaw->base.energy[0];
+        const double e1 = powerlaw->base.energy[1];
+        if (e0 == e1) {
+                *pdf = 1.;
+                return e0;
+        }
+
+        const double a1 = powerlaw->exponent + 1.;
+        double energy = (a1 == 0.) ?
+            e0 * exp(powerlaw->range * u) :
+            e0 * pow(1. + u * powerlaw->range, 1. / a1);
+        if (energy < e0)
+                energy = e0;
+        else if (energy > e1)
+                energy = e1;
+        *pdf = powerlaw->normalisation * pow(energy / e0, powerlaw->exponent);
+        return energy;
+}
+
+/* API function for setting the parameters of a power law spectrum. */
+int danton_powerlaw_set(struct danton_powerlaw * powerlaw, double energy_min,
+    double energy_max, double exponent, double weight)
+{
+        /* Check the arguments. */
+        if ((energy_min <= 0.) || (energy_min > energy_max) || (weight < 0.)) {
+                danton_error_push(NULL,
+                    "%s (%d): invalid argument(s) (%.5lE, %.5lE, %.5lE).",
+                    __FILE__, __LINE__, energy_min, energy_max, weight);
+                return EXIT_FAILURE;
+        }
+
+        /* Set the parameters and pre-compute the normalisation, such that the
+         * pdf is `normalisation * (E / E0)^exponent`.
+         */
+        powerlaw->base.energy[0] = energy_min;
+        powerlaw->base.energy[1] = energy_max;
+        powerlaw->exponent = exponent;
+        powerlaw->weight = weight;
+
+        const double a1 = exponent + 1.;
+        if (energy_min == energy_max) {
+                powerlaw->range = 0.;
+                powerlaw->normalisation = 0.;
+        } else if (a1 == 0.) {
+                powerlaw->range = log(energy_max / energy_min);
+                powerlaw->normalisation = 1. / (powerlaw->range * energy_min);
+        } else {
+                powerlaw->range = pow(energy_max / energy_min, a1) - 1.;
+                powerlaw->normalisation =
+                    a1 / (powerlaw->range * energy_min);
+        }
+
+        return EXIT_SUCCESS;
+}
+
 /* API function for creating a new power law spectrum. */
 struct danton_powerlaw * danton_powerlaw_create(
     double energy_min, double energy_max, double exponent, double weight)
@@ -58,8 +106,8 @@ struct danton_powerlaw * danton_powerlaw_create(
         /* Check the arguments. */
         if ((energy_min <= 0.) || (energy_min >= energy_max) || (weight < 0.)) {
                 danton_error_push(NULL,
-                    "%s (%d): invalid argument(s) (%.5lE, %.5lE).", __FILE__,
-                    __LINE__);
+                    "%s (%d): invalid argument(s) (%.5lE, %.5lE, %.5lE).",
+                    __FILE__, __LINE__, energy_min, energy_max, weight);
                 return NULL;
         }
 
@@ -73,10 +121,8 @@ struct danton_powerlaw * danton_powerlaw_create(
 
         /* Initialise the power law spectrum and return. */
         powerlaw->base.flux = &flux;
-        powerlaw->base.energy[0] = energy_min;
-        powerlaw->base.energy[1] = energy_max;
-        powerlaw->exponent = exponent;
-        powerlaw->weight = weight;
+        powerlaw->base.sample = &sample;
+        danton_powerlaw_set(powerlaw, energy_min, energy_max, exponent, weight);
 
         return powerlaw;
 }
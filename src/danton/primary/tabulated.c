@@ -0,0 +1,282 @@
+/*
+ * Copyright (C) 2017 Université Clermont Auvergne, CNRS/IN2P3, LPC
+ * Author: Valentin NIESS (niess@in2p3.fr)
+ *
+ * This software is a C99 executable dedicated to the sampling of decaying
+ * taus from ultra high energy neutrinos.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/* Standard library includes. */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* The DANTON API. */
+#include "danton.h"
+#include "danton/primary/tabulated.h"
+
+/* Data container for a tabulated spectrum. */
+struct danton_tabulated {
+        struct danton_primary base;
+        /* The number of nodes and the integrated flux. */
+        int n;
+        double total;
+        /* The log of the tabulated energies and the flux values. */
+        double * x;
+        double * f;
+        /* The power law index and the integral of each segment. */
+        double * g;
+        /* The cumulative integral of the flux at each node. */
+        double * cdf;
+        /* Guide tables for locating a segment in constant time. */
+        double dx;
+        int * x_guide;
+        int * cdf_guide;
+        /* Placeholder for the tables. */
+        double data[];
+};
+
+/* Locate the segment of a log-energy value. */
+static int locate_x(const struct danton_tabulated * tabulated, double x)
+{
+        const int m = tabulated->n - 1;
+        int k = (int)((x - tabulated->x[0]) / tabulated->dx);
+        if (k < 0)
+                k = 0;
+        else if (k >= m)
+                k = m - 1;
+        int i = tabulated->x_guide[k];
+        while ((i < m - 1) && (x >= tabulated->x[i + 1])) i++;
+        return i;
+}
+
+/* Flux callback for the tabulated spectrum. */
+static double flux(struct danton_primary * primary, double energy)
+{
+        struct danton_tabulated * tabulated =
+            (struct danton_tabulated *)primary;
+        if (energy > 0.) {
+                if ((energy < tabulated->base.energy[0]) ||
+                    (energy > tabulated->base.energy[1]))
+                        return 0.;
+                const double x = log(energy);
+                const int i = locate_x(tabulated, x);
+                if ((tabulated->f[i] <= 0.) || (tabulated->f[i + 1] <= 0.))
+                        return 0.;
+                return tabulated->f[i] *
+                    exp(tabulated->g[i] * (x - tabulated->x[i]));
+        } else
+                return tabulated->total;
+}
+
+/* API function for sampling the energy from a tabulated spectrum. */
+double danton_tabulated_sample(
+    const struct danton_tabulated * tabulated, double u, double * pdf)
+{
+        /* Locate the segment from the cumulative table. */
+        const int m = tabulated->n - 1;
+        const double c = u * tabulated->total;
+        int k = (int)(u * m);
+        if (k < 0)
+                k = 0;
+        else if (k >= m)
+                k = m - 1;
+        int i = tabulated->cdf_guide[k];
+        while ((i < m - 1) && (c >= tabulated->cdf[i + 1])) i++;
+
+        /* Invert the power law integral over the segment. */
+        const double xi = tabulated->x[i];
+        const double fi = tabulated->f[i];
+        if ((fi <= 0.) || (tabulated->f[i + 1] <= 0.) ||
+            (tabulated->total <= 0.)) {
+                if (pdf != NULL) *pdf = 0.;
+                return exp(xi);
+        }
+        const double t = (c - tabulated->cdf[i]) / (fi * exp(xi));
+        const double a = tabulated->g[i] + 1.;
+        double dx = (fabs(a) < 1E-12) ? t : log1p(a * t) / a;
+        const double L = tabulated->x[i + 1] - xi;
+        if (!(dx > 0.))
+                dx = 0.;
+        else if (dx > L)
+                dx = L;
+
+        if (pdf != NULL)
+                *pdf = fi * exp(tabulated->g[i] * dx) / tabulated->total;
+        return exp(xi + dx);
+}
+
+/* Sampling callback for the tabulated spectrum. */
+static double sample(struct danton_primary * primary, double u, double * pdf)
+{
+        return danton_tabulated_sample(
+            (struct danton_tabulated *)primary, u, pdf);
+}
+
+/* API function for creating a new tabulated spectrum. */
+struct danton_tabulated * danton_tabulated_create(
+    int n, const double * energy, const double * flux_)
+{
+        /* Check the arguments. */
+        if ((n < 2) || (energy == NULL) || (flux_ == NULL)) {
+                danton_error_push(NULL, "%s (%d): invalid argument(s).",
+                    __FILE__, __LINE__);
+                return NULL;
+        }
+        int i;
+        for (i = 0; i < n; i++) {
+                if ((energy[i] <= 0.) || (flux_[i] < 0.) ||
+                    ((i > 0) && (energy[i] <= energy[i - 1]))) {
+                        danton_error_push(NULL,
+                            "%s (%d): invalid table value(s) (%.5lE, %.5lE).",
+                            __FILE__, __LINE__, energy[i], flux_[i]);
+                        return NULL;
+                }
+        }
+
+        /* Allocate the memory for the new tabulated spectrum. */
+        struct danton_tabulated * tabulated;
+        const int m = n - 1;
+        const size_t size = sizeof(*tabulated) +
+            (3 * n + m) * sizeof(*tabulated->data) +
+            2 * m * sizeof(*tabulated->x_guide);
+        if ((tabulated = malloc(size)) == NULL) {
+                danton_error_push(NULL, "%s (%d): could not allocate memory.",
+                    __FILE__, __LINE__);
+                return NULL;
+        }
+        tabulated->n = n;
+        tabulated->x = tabulated->data;
+        tabulated->f = tabulated->x + n;
+        tabulated->g = tabulated->f + n;
+        tabulated->cdf = tabulated->g + m;
+        tabulated->x_guide = (int *)(tabulated->cdf + n);
+        tabulated->cdf_guide = tabulated->x_guide + m;
+
+        /* Compute the power law segments and their cumulative integral. */
+        for (i = 0; i < n; i++) {
+                tabulated->x[i] = log(energy[i]);
+                tabulated->f[i] = flux_[i];
+        }
+        tabulated->cdf[0] = 0.;
+        for (i = 0; i < m; i++) {
+                const double L = tabulated->x[i + 1] - tabulated->x[i];
+                double I = 0.;
+                if ((flux_[i] > 0.) && (flux_[i + 1] > 0.)) {
+                        const double g = log(flux_[i + 1] / flux_[i]) / L;
+                        const double a = g + 1.;
+                        tabulated->g[i] = g;
+                        I = flux_[i] * energy[i] *
+                            ((fabs(a * L) < 1E-12) ? L : expm1(a * L) / a);
+                } else
+                        tabulated->g[i] = 0.;
+                tabulated->cdf[i + 1] = tabulated->cdf[i] + I;
+        }
+        tabulated->total = tabulated->cdf[m];
+
+        /* Build the guide tables, over a uniform grid in log-energy and
+         * in cumulative flux.
+         */
+        tabulated->dx = (tabulated->x[m] - tabulated->x[0]) / m;
+        int k;
+        for (i = 0, k = 0; k < m; k++) {
+                const double x = tabulated->x[0] + k * tabulated->dx;
+                while ((i < m - 1) && (tabulated->x[i + 1] <= x)) i++;
+                tabulated->x_guide[k] = i;
+        }
+        for (i = 0, k = 0; k < m; k++) {
+                const double c = k * tabulated->total / m;
+                while ((i < m - 1) && (tabulated->cdf[i + 1] <= c)) i++;
+                tabulated->cdf_guide[k] = i;
+        }
+
+        /* Initialise the base primary and return. */
+        tabulated->base.flux = &flux;
+        tabulated->base.sample = &sample;
+        tabulated->base.energy[0] = energy[0];
+        tabulated->base.energy[1] = energy[m];
+
+        return tabulated;
+}
+
+/* API function for loading a tabulated spectrum from a file. */
+struct danton_tabulated * danton_tabulated_load(const char * path)
+{
+        FILE * stream;
+        if ((stream = fopen(path, "r")) == NULL) {
+                danton_error_push(NULL, "%s (%d): could not open file `%s`.",
+                    __FILE__, __LINE__, path);
+                return NULL;
+        }
+
+        /* Parse the table, line by line. */
+        struct danton_tabulated * tabulated = NULL;
+        double *energy = NULL, *flux_ = NULL;
+        int n = 0, size = 0, line = 0;
+        char buffer[1024];
+        while (fgets(buffer, sizeof(buffer), stream) != NULL) {
+                line++;
+                char * s = buffer;
+                while ((*s == ' ') || (*s == '\t')) s++;
+                if ((*s == '#') || (*s == '\n') || (*s == '\r') ||
+                    (*s == '\0'))
+                        continue;
+
+                if (n >= size) {
+                        size = (size == 0) ? 64 : 2 * size;
+                        double * tmp;
+                        if ((tmp = realloc(energy, size * sizeof(*tmp))) ==
+                            NULL)
+                                goto error_memory;
+                        energy = tmp;
+                        if ((tmp = realloc(flux_, size * sizeof(*tmp))) ==
+                            NULL)
+                                goto error_memory;
+                        flux_ = tmp;
+                }
+
+                char * end;
+                energy[n] = strtod(s, &end);
+                if (end != s) {
+                        s = end;
+                        flux_[n] = strtod(s, &end);
+                }
+                if (end == s) {
+                        danton_error_push(NULL,
+                            "%s (%d): invalid format for `%s` at line %d.",
+                            __FILE__, __LINE__, path, line);
+                        goto exit;
+                }
+                n++;
+        }
+        tabulated = danton_tabulated_create(n, energy, flux_);
+        goto exit;
+
+error_memory:
+        danton_error_push(
+            NULL, "%s (%d): could not allocate memory.", __FILE__, __LINE__);
+exit:
+        fclose(stream);
+        free(energy);
+        free(flux_);
+        return tabulated;
+}
+
+/* API function for checking for a tabulated type. */
+int danton_tabulated_check(struct danton_primary * primary)
+{
+        return (primary->flux == &flux);
+}
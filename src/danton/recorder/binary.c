@@ -0,0 +1,359 @@
+/*
+ * Copyright (C) 2017 Université Clermont Auvergne, CNRS/IN2P3, LPC
+ * Author: Valentin NIESS (niess@in2p3.fr)
+ *
+ * This software is a C99 executable dedicated to the sampling of decaying
+ * taus from ultra high energy neutrinos.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/* Standard library includes. */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The DANTON API. */
+#include "danton.h"
+#include "danton/recorder/binary.h"
+
+/* The default size of the user-space output buffer, in bytes. */
+#define BINARY_BUFFER_SIZE 1048576
+
+/* The magic string starting a binary file. */
+#define BINARY_MAGIC "DANTONBF"
+
+/* Packed sizes of the serialised objects, in bytes. */
+#define BINARY_SIZE_STATE (4 + 7 * 8)
+#define BINARY_SIZE_PRODUCT (4 + 3 * 8)
+#define BINARY_SIZE_RUN (3 * 4 + 10 * 8 + 4 + DANTON_PARTICLE_N * 8)
+
+/* Low level data structure for the binary recorder. */
+struct binary_recorder {
+        struct danton_binary api;
+        FILE * stream;
+        char * buffer;
+        size_t size;
+        unsigned char * data;
+        char path[];
+};
+
+/* Helper functions for packing numbers in little-endian order. */
+static unsigned char * pack_u64(unsigned char * p, uint64_t u)
+{
+        int i;
+        for (i = 0; i < 8; i++, u >>= 8) *p++ = (unsigned char)(u & 0xFF);
+        return p;
+}
+
+static unsigned char * pack_u32(unsigned char * p, uint32_t u)
+{
+        int i;
+        for (i = 0; i < 4; i++, u >>= 8) *p++ = (unsigned char)(u & 0xFF);
+        return p;
+}
+
+static unsigned char * pack_i32(unsigned char * p, int32_t i)
+{
+        return pack_u32(p, (uint32_t)i);
+}
+
+static unsigned char * pack_f64(unsigned char * p, double d)
+{
+        uint64_t u;
+        memcpy(&u, &d, sizeof(u));
+        return pack_u64(p, u);
+}
+
+/* Serialise a particle state. */
+static unsigned char * pack_state(
+    unsigned char * p, const struct danton_state * state)
+{
+        p = pack_i32(p, state->pid);
+        p = pack_f64(p, state->energy);
+        int i;
+        for (i = 0; i < 3; i++) p = pack_f64(p, state->position[i]);
+        for (i = 0; i < 3; i++) p = pack_f64(p, state->direction[i]);
+        return p;
+}
+
+/* Get a work buffer of at least the given size. */
+static unsigned char * reserve(
+    struct danton_context * context, struct binary_recorder * binary,
+    size_t size)
+{
+        if (size <= binary->size) return binary->data;
+        unsigned char * data = realloc(binary->data, size);
+        if (data == NULL) {
+                danton_error_push(context,
+                    "%s (%d): could not allocate memory\n", __FILE__,
+                    __LINE__);
+                return NULL;
+        }
+        binary->data = data;
+        binary->size = size;
+        return data;
+}
+
+/* Write a chunk of data to the output stream. */
+static int output_write(struct danton_context * context,
+    struct binary_recorder * binary, FILE * stream, size_t size)
+{
+        if (fwrite(binary->data, 1, size, stream) != size) {
+                danton_error_push(context, "%s (%d): could not write to `%s`\n",
+                    __FILE__, __LINE__,
+                    (binary->path[0] == 0x0) ? "stdout" : binary->path);
+                return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+}
+
+/* Write the file header describing the run. */
+static int format_header(struct danton_context * context,
+    struct binary_recorder * binary, FILE * stream)
+{
+        const size_t size = 8 + 2 * 4 + BINARY_SIZE_RUN;
+        unsigned char * p = reserve(context, binary, size);
+        if (p == NULL) return EXIT_FAILURE;
+
+        memcpy(p, BINARY_MAGIC, 8);
+        p = pack_u32(p + 8, DANTON_BINARY_VERSION);
+        p = pack_u32(p, BINARY_SIZE_RUN);
+        p = pack_i32(p, context->mode);
+        p = pack_i32(p, context->decay);
+        p = pack_i32(p, context->longitudinal);
+
+        struct danton_sampler null_sampler;
+        const struct danton_sampler * s = context->sampler;
+        if (s == NULL) {
+                memset(&null_sampler, 0x0, sizeof(null_sampler));
+                s = &null_sampler;
+        }
+        p = pack_f64(p, s->latitude);
+        p = pack_f64(p, s->longitude);
+        int i;
+        for (i = 0; i < 2; i++) p = pack_f64(p, s->altitude[i]);
+        for (i = 0; i < 2; i++) p = pack_f64(p, s->azimuth[i]);
+        for (i = 0; i < 2; i++) p = pack_f64(p, s->elevation[i]);
+        for (i = 0; i < 2; i++) p = pack_f64(p, s->energy[i]);
+        p = pack_u32(p, DANTON_PARTICLE_N);
+        for (i = 0; i < DANTON_PARTICLE_N; i++) p = pack_f64(p, s->weight[i]);
+
+        return output_write(context, binary, stream, size);
+}
+
+/* Get the output stream, opening it if not already done.
+ *
+ * The stream is kept open for the lifetime of the recorder. The file header
+ * is written whenever a new or empty file is opened.
+ */
+static FILE * output_open(
+    struct danton_context * context, struct binary_recorder * binary)
+{
+        if (binary->path[0] == 0x0) {
+                if (binary->api.mode == DANTON_BINARY_MODE_CREATE) {
+                        if (format_header(context, binary, stdout) !=
+                            EXIT_SUCCESS)
+                                return NULL;
+                        binary->api.mode = DANTON_BINARY_MODE_APPEND;
+                }
+                return stdout;
+        }
+        if (binary->stream != NULL) {
+                if (binary->api.mode != DANTON_BINARY_MODE_CREATE)
+                        return binary->stream;
+                danton_binary_close(&binary->api);
+        }
+
+        const char * mode =
+            (binary->api.mode == DANTON_BINARY_MODE_CREATE) ? "wb+" : "ab+";
+        FILE * stream = fopen(binary->path, mode);
+        if (stream == NULL) {
+                danton_error_push(context,
+                    "%s (%d): could not open file `%s`\n", __FILE__, __LINE__,
+                    binary->path);
+                return NULL;
+        }
+
+        /* Set the user-space buffer, if any. */
+        if (binary->api.buffer_size > 0) {
+                binary->buffer = malloc(binary->api.buffer_size);
+                if ((binary->buffer == NULL) ||
+                    (setvbuf(stream, binary->buffer, _IOFBF,
+                         binary->api.buffer_size) != 0)) {
+                        free(binary->buffer);
+                        binary->buffer = NULL;
+                }
+        }
+        binary->stream = stream;
+
+        /* Write the header if the file is new. */
+        fseek(stream, 0, SEEK_END);
+        if (ftell(stream) == 0) {
+                if (format_header(context, binary, stream) != EXIT_SUCCESS)
+                        return NULL;
+        }
+
+        /* Let us go back to append mode for next calls. */
+        binary->api.mode = DANTON_BINARY_MODE_APPEND;
+
+        return stream;
+}
+
+/* Callback for recording an event. */
+static int record_event(struct danton_context * context,
+    struct danton_recorder * recorder, const struct danton_event * event)
+{
+        /* Unpack the binary recorder object and get the output stream. */
+        struct binary_recorder * binary = (struct binary_recorder *)recorder;
+        FILE * stream = output_open(context, binary);
+        if (stream == NULL) return EXIT_FAILURE;
+
+        /* Compute the record size and reserve the memory. */
+        const struct danton_state * states[3] = { event->primary,
+                event->vertex, event->final };
+        int flags = 0, i;
+        size_t size = 1 + 8 + 8 + 4 + 1 + 4;
+        for (i = 0; i < 3; i++) {
+                if (states[i] == NULL) continue;
+                flags |= 1 << i;
+                size += BINARY_SIZE_STATE;
+        }
+        const int n_products = (event->product == NULL) ? 0 : event->n_products;
+        size += n_products * BINARY_SIZE_PRODUCT;
+        unsigned char * p = reserve(context, binary, size + 4);
+        if (p == NULL) return EXIT_FAILURE;
+
+        /* Serialise the event. */
+        p = pack_u32(p, (uint32_t)size);
+        *p++ = DANTON_BINARY_RECORD_EVENT;
+        p = pack_u64(p, (uint64_t)(int64_t)event->id);
+        p = pack_f64(p, event->weight);
+        p = pack_i32(p, event->generation);
+        *p++ = (unsigned char)flags;
+        for (i = 0; i < 3; i++) {
+                if (states[i] != NULL) p = pack_state(p, states[i]);
+        }
+        p = pack_i32(p, n_products);
+        const struct danton_product * product;
+        for (i = 0, product = event->product; i < n_products; i++, product++) {
+                p = pack_i32(p, product->pid);
+                int j;
+                for (j = 0; j < 3; j++) p = pack_f64(p, product->momentum[j]);
+        }
+
+        return output_write(context, binary, stream, size + 4);
+}
+
+/* Callback for recording a grammage point. */
+static int record_grammage(struct danton_context * context,
+    struct danton_recorder * recorder, const struct danton_grammage * grammage)
+{
+        /* Unpack the binary recorder object and get the output stream. */
+        struct binary_recorder * binary = (struct binary_recorder *)recorder;
+        FILE * stream = output_open(context, binary);
+        if (stream == NULL) return EXIT_FAILURE;
+
+        /* Serialise the grammage data point. */
+        const size_t size = 1 + 2 * 8;
+        unsigned char * p = reserve(context, binary, size + 4);
+        if (p == NULL) return EXIT_FAILURE;
+        p = pack_u32(p, (uint32_t)size);
+        *p++ = DANTON_BINARY_RECORD_GRAMMAGE;
+        p = pack_f64(p, grammage->elevation);
+        p = pack_f64(p, grammage->value);
+
+        return output_write(context, binary, stream, size + 4);
+}
+
+/* API function for creating a new binary recorder. */
+struct danton_binary * danton_binary_create(const char * path)
+{
+        /* Allocate the memory for the new binary recorder. */
+        const int n = (path == NULL) ? 1 : strlen(path) + 1;
+        struct binary_recorder * binary;
+        if ((binary = malloc(sizeof(*binary) + n)) == NULL) {
+                danton_error_push(NULL, "%s (%d): could not allocate memory\n",
+                    __FILE__, __LINE__);
+                return NULL;
+        }
+
+        /* Initialise the binary recorder and return. */
+        binary->api.base.record_event = &record_event;
+        binary->api.base.record_grammage = &record_grammage;
+        binary->api.mode = DANTON_BINARY_MODE_CREATE;
+        binary->api.buffer_size = BINARY_BUFFER_SIZE;
+        binary->stream = NULL;
+        binary->buffer = NULL;
+        binary->size = 0;
+        binary->data = NULL;
+        if (n > 1)
+                memcpy(binary->path, path, n);
+        else
+                binary->path[0] = 0x0;
+
+        return &binary->api;
+}
+
+/* API function for flushing the output stream of a binary recorder. */
+int danton_binary_flush(struct danton_binary * binary)
+{
+        struct binary_recorder * binary_ = (struct binary_recorder *)binary;
+        FILE * stream = (binary_->path[0] == 0x0) ? stdout : binary_->stream;
+        if ((stream != NULL) && (fflush(stream) != 0)) {
+                danton_error_push(NULL, "%s (%d): could not flush `%s`\n",
+                    __FILE__, __LINE__,
+                    (binary_->path[0] == 0x0) ? "stdout" : binary_->path);
+                return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+}
+
+/* API function for closing the output stream of a binary recorder. */
+int danton_binary_close(struct danton_binary * binary)
+{
+        struct binary_recorder * binary_ = (struct binary_recorder *)binary;
+        if (binary_->path[0] == 0x0) return danton_binary_flush(binary);
+        if (binary_->stream == NULL) return EXIT_SUCCESS;
+
+        int rc = EXIT_SUCCESS;
+        if (fclose(binary_->stream) != 0) {
+                danton_error_push(NULL, "%s (%d): could not close `%s`\n",
+                    __FILE__, __LINE__, binary_->path);
+                rc = EXIT_FAILURE;
+        }
+        binary_->stream = NULL;
+        free(binary_->buffer);
+        binary_->buffer = NULL;
+        return rc;
+}
+
+/* API function for destroying a binary recorder. */
+void danton_binary_destroy(struct danton_binary ** binary)
+{
+        if (*binary == NULL) return;
+        danton_binary_close(*binary);
+        struct binary_recorder * binary_ = (struct binary_recorder *)(*binary);
+        free(binary_->data);
+        free(binary_);
+        *binary = NULL;
+}
+
+/* API function for checking for a binary recorder type. */
+int danton_binary_check(struct danton_recorder * recorder)
+{
+        return ((recorder->record_event == &record_event) &&
+            (recorder->record_grammage == &record_grammage));
+}
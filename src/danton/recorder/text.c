@@ -28,18 +28,34 @@
 #include "danton.h"
 #include "danton/recorder/text.h"
 
+/* The default size of the user-space output buffer, in bytes. */
+#define TEXT_BUFFER_SIZE 1048576
+
 /* Low level data structure for the text recorder. */
 struct text_recorder {
         struct danton_text api;
         long last_id;
+        FILE * stream;
+        char * buffer;
         char path[];
 };
 
-/* Create or append to the output stream. */
+/* Get the output stream, opening it if not already done.
+ *
+ * The stream is kept open for the lifetime of the recorder. Note that
+ * switching back to the create mode re-opens the file, overriding its
+ * content.
+ */
 static FILE * output_open(
     struct danton_context * context, struct text_recorder * text)
 {
         if (text->path[0] == 0x0) return stdout;
+        if (text->stream != NULL) {
+                if (text->api.mode != DANTON_TEXT_MODE_CREATE)
+                        return text->stream;
+                danton_text_close(&text->api);
+        }
+
         const char * mode =
             (text->api.mode == DANTON_TEXT_MODE_CREATE) ? "w+" : "a+";
         FILE * stream = fopen(text->path, mode);
@@ -49,13 +65,20 @@ static FILE * output_open(
                     text->path);
                 return NULL;
         }
-        return stream;
-}
 
-/* Close the output stream. */
-static void output_close(struct text_recorder * text, FILE * stream)
-{
-        if (text->path[0] != 0x0) fclose(stream);
+        /* Set the user-space buffer, if any. */
+        if (text->api.buffer_size > 0) {
+                text->buffer = malloc(text->api.buffer_size);
+                if ((text->buffer == NULL) ||
+                    (setvbuf(stream, text->buffer, _IOFBF,
+                         text->api.buffer_size) != 0)) {
+                        free(text->buffer);
+                        text->buffer = NULL;
+                }
+        }
+        text->stream = stream;
+
+        return stream;
 }
 
 /* Format the header for a Monte-Carlo event. */
@@ -163,9 +186,6 @@ static int record_event(struct danton_context * context,
         for (i = 0, p = event->product; i < event->n_products; i++, p++)
                 format_product(stream, p);
 
-        /* Close the output stream. */
-        output_close(text, stream);
-
         return EXIT_SUCCESS;
 }
 
@@ -191,9 +211,6 @@ static int record_grammage(struct danton_context * context,
         /* Format the grammage data point. */
         format_grammage(stream, grammage);
 
-        /* Close the output stream. */
-        output_close(text, stream);
-
         return EXIT_SUCCESS;
 }
 
@@ -213,7 +230,10 @@ struct danton_text * danton_text_create(const char * path)
         text->api.base.record_event = &record_event;
         text->api.base.record_grammage = &record_grammage;
         text->api.mode = DANTON_TEXT_MODE_CREATE;
+        text->api.buffer_size = TEXT_BUFFER_SIZE;
         text->last_id = -1;
+        text->stream = NULL;
+        text->buffer = NULL;
         if (n > 1)
                 memcpy(text->path, path, n);
         else
@@ -222,6 +242,48 @@ struct danton_text * danton_text_create(const char * path)
         return &text->api;
 }
 
+/* API function for flushing the output stream of a text recorder. */
+int danton_text_flush(struct danton_text * text)
+{
+        struct text_recorder * text_ = (struct text_recorder *)text;
+        FILE * stream = (text_->path[0] == 0x0) ? stdout : text_->stream;
+        if ((stream != NULL) && (fflush(stream) != 0)) {
+                danton_error_push(NULL, "%s (%d): could not flush `%s`\n",
+                    __FILE__, __LINE__,
+                    (text_->path[0] == 0x0) ? "stdout" : text_->path);
+                return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+}
+
+/* API function for closing the output stream of a text recorder. */
+int danton_text_close(struct danton_text * text)
+{
+        struct text_recorder * text_ = (struct text_recorder *)text;
+        if (text_->path[0] == 0x0) return danton_text_flush(text);
+        if (text_->stream == NULL) return EXIT_SUCCESS;
+
+        int rc = EXIT_SUCCESS;
+        if (fclose(text_->stream) != 0) {
+                danton_error_push(NULL, "%s (%d): could not close `%s`\n",
+                    __FILE__, __LINE__, text_->path);
+                rc = EXIT_FAILURE;
+        }
+        text_->stream = NULL;
+        free(text_->buffer);
+        text_->buffer = NULL;
+        return rc;
+}
+
+/* API function for destroying a text recorder. */
+void danton_text_destroy(struct danton_text ** text)
+{
+        if (*text == NULL) return;
+        danton_text_close(*text);
+        free(*text);
+        *text = NULL;
+}
+
 /* API function for checking for a text recorder type. */
 int danton_text_check(struct danton_recorder * recorder)
 {